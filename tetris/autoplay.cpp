@@ -0,0 +1,285 @@
+#include "autoplay.h"
+
+#include <algorithm>
+
+#include "trace.h"
+
+using namespace std;
+
+void LookaheadSearch::setPosition(const GameSnapshot& position)
+{
+    const auto& pieces = position.pieces;
+    mRoot = position.playfield;
+    mActive = pieces.active;
+    mQueueSize = 0;
+    mQueue[mQueueSize++] = pieces.active.type;
+    for (const auto& next : pieces.next)
+        mQueue[mQueueSize++] = next.type;
+    mRootPieces = { 0, pieces.holding, pieces.held.type };
+    mCanHold = !pieces.hasHeld;
+}
+
+bool LookaheadSearch::search(int depth, int beam, const atomic<bool>& abort, Result& result)
+{
+    TRACE_SCOPE("LookaheadSearch::search");
+    beam = beam < 1 ? 1 : beam > MAX_BEAM ? MAX_BEAM : beam;
+    depth = min(depth, mQueueSize);
+
+    auto* layer = &mBeams[0];
+    auto* next = &mBeams[1];
+    (*layer)[0] = { mRoot, mRootPieces, 0, { false, mActive, LOST } };
+    int size = 1;
+    Result best { false, mActive, LOST };
+    for (int ply = 0; ply != depth && size != 0; ++ply)
+    {
+        int count = 0;
+        for (int i = 0; i != size; ++i)
+        {
+            if (abort.load(memory_order_relaxed))
+                return false;
+            count = expand((*layer)[i], i, beam, count);
+        }
+        sort(mChildren.begin(), mChildren.begin() + count, [] (const Child& a, const Child& b) { return a.value > b.value; });
+
+        // A child whose next piece is not known yet ends its line here; the rest go on.
+        int kept = 0;
+        for (int i = 0; i != count; ++i)
+        {
+            const auto& child = mChildren[i];
+            const auto& parent = (*layer)[child.parent];
+            auto first = ply == 0 ? Result { child.hold, child.piece, child.value } : parent.first;
+            auto pieces = after(parent.pieces, child.hold);
+            if (ply + 1 == depth || pieces.index >= mQueueSize)
+            {
+                if (child.value > best.score)
+                    best = { first.hold, first.piece, child.value };
+                continue;
+            }
+
+            auto& node = (*next)[kept++];
+            node.board = parent.board;
+            node.board.onLanding(child.piece.split(), child.piece.type);
+            node.pieces = pieces;
+            node.reward = child.reward;
+            node.first = first;
+        }
+        swap(layer, next);
+        size = kept;
+    }
+    if (abort.load(memory_order_relaxed) || best.score <= LOST)
+        return false;
+    result = best;
+    return true;
+}
+
+int LookaheadSearch::expand(const Node& node, int parent, int beam, int count)
+{
+    ++mNodes;
+    const auto& pieces = node.pieces;
+    auto current = mQueue[pieces.index];
+    bool root = pieces.index == 0;
+    const auto& board = node.board;
+    count = addChildren(board, root ? mActive : TetrominoController::spawnOn(board, current), false, node.reward, parent, count);
+    if (!root || mCanHold)
+    {
+        if (pieces.holding && pieces.held != current)
+            count = addChildren(board, TetrominoController::spawnOn(board, pieces.held), true, node.reward, parent, count);
+        else if (!pieces.holding && pieces.index + 1 < mQueueSize)
+            count = addChildren(board, TetrominoController::spawnOn(board, mQueue[pieces.index + 1]), true, node.reward, parent, count);
+    }
+
+    if (count > beam)
+    {
+        nth_element(mChildren.begin(), mChildren.begin() + beam - 1, mChildren.begin() + count,
+            [] (const Child& a, const Child& b) { return a.value > b.value; });
+        count = beam;
+    }
+    return count;
+}
+
+int LookaheadSearch::addChildren(const Playfield& board, const Tetromino& start, bool hold, float reward, int parent, int count)
+{
+    mGenerator.generate(board, start);
+    for (auto placement = mGenerator.begin(); placement != mGenerator.end();)
+    {
+        int first = count;
+        mBatch.reset(board);
+        for (; placement != mGenerator.end() && mBatch.size() != BoardBatch::LANES; ++placement)
+        {
+            if (!placement->piece.visiable())
+                continue;
+            mBatch.add(placement->piece.split());
+            mChildren[count++] = { 0, 0, placement->piece, hold, parent };
+        }
+
+        mBatch.evaluate(mBatchResult);
+        for (int lane = 0; first + lane != count; ++lane)
+        {
+            mChildren[first + lane].value = reward + mWeights.evaluate(featuresOf(mBatchResult, lane));
+            mChildren[first + lane].reward = reward + rewardOf(mBatchResult.cleared[lane]);
+        }
+    }
+    return count;
+}
+
+LookaheadSearch::Pieces LookaheadSearch::after(const Pieces& pieces, bool hold) const
+{
+    Pieces next { pieces.index + 1, pieces.holding, pieces.held };
+    if (hold)
+    {
+        next.index += pieces.holding ? 0 : 1;
+        next.holding = true;
+        next.held = mQueue[pieces.index];
+    }
+    return next;
+}
+
+float LookaheadSearch::rewardOf(int cleared) const
+{
+    return cleared > 0 ? mWeights.values[static_cast<int>(Feature::Singles) + cleared - 1] : 0;
+}
+
+AutoPlayer::AutoPlayer(const Settings& settings)
+    : mSettings(settings), mFallback(settings.weights), mSearch(settings.weights)
+{
+    mThread = thread(&AutoPlayer::run, this);
+}
+
+AutoPlayer::~AutoPlayer()
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStopping = true;
+        mAbort.store(true, memory_order_relaxed);
+    }
+    mWake.notify_one();
+    mThread.join();
+}
+
+bool AutoPlayer::step(const GameContext& context, uint64_t micros, Input& input)
+{
+    // Gravity or the lock delay put the piece down before the plan did.
+    if (mPhase != Phase::Idle && context.playfield().hash() != mBoard)
+        mPhase = Phase::Idle;
+
+    auto rowMicros = context.scoreBoard().microsPerRow();
+    if (mPhase == Phase::Idle)
+    {
+        submit(context);
+        mBoard = context.playfield().hash();
+        mDeadline = micros + min(mSettings.thinkMicros, rowMicros * THINK_ROWS);
+        mPhase = Phase::Thinking;
+        return false;
+    }
+
+    if (mPhase == Phase::Thinking)
+    {
+        mResults.update();
+        const auto& published = mResults.front();
+        bool current = published.job == mJob;
+        if (micros < mDeadline && !(current && published.finished))
+            return false;
+
+        Bot::Decision decision;
+        if (current && published.found)
+            mChosen = published.result;
+        else if (mFallback.decide(context, decision))
+            mChosen = { decision.hold, decision.piece, decision.score };
+        else
+            mChosen = { false, context.controller().active(), 0 };
+        mHoldPending = mChosen.hold;
+        mPlanned = false;
+        mNextInput = micros;
+        mPhase = Phase::Moving;
+    }
+
+    if (micros < mNextInput)
+        return false;
+    mNextInput = micros + min(mSettings.inputMicros, rowMicros / INPUTS_PER_ROW);
+
+    if (mHoldPending)
+    {
+        mHoldPending = false;
+        input = Input::Hold;
+        return true;
+    }
+    if (!mPlanned)
+        plan(context);
+
+    input = mPath.inputs[mPathIndex++];
+    if (mPathIndex == mPath.length)
+        mPhase = Phase::Idle;
+    return true;
+}
+
+void AutoPlayer::submit(const GameContext& context)
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        context.snapshot(mPosition);
+        mJob = ++mSubmitted;
+        mAbort.store(true, memory_order_relaxed);
+    }
+    mWake.notify_one();
+}
+
+// The path is found from wherever the piece is now, since it has been falling all along.
+void AutoPlayer::plan(const GameContext& context)
+{
+    mPathIndex = 0;
+    mPlanned = true;
+    mGenerator.generate(context.playfield(), context.controller().active());
+    if (auto placement = mGenerator.placementOf(mChosen.piece))
+    {
+        mGenerator.path(*placement, mPath);
+        return;
+    }
+    mPath.inputs[0] = Input::HardDrop;
+    mPath.length = 1;
+}
+
+void AutoPlayer::run()
+{
+    Trace::nameThread("bot");
+    uint64_t job = 0;
+    for (;;)
+    {
+        {
+            unique_lock<mutex> lock(mMutex);
+            mWake.wait(lock, [&] { return mStopping || mSubmitted != job; });
+            if (mStopping)
+                return;
+            job = mSubmitted;
+            mSearch.setPosition(mPosition);
+            mAbort.store(false, memory_order_relaxed);
+        }
+
+        // Deepen over the known pieces first, then widen the beam, publishing after each pass.
+        LookaheadSearch::Result result;
+        bool found = false;
+        bool aborted = false;
+        for (int depth = 1, beam = FIRST_BEAM;;)
+        {
+            if (!mSearch.search(depth, beam, mAbort, result))
+            {
+                aborted = mAbort.load(memory_order_relaxed);
+                break;
+            }
+            found = true;
+            if (depth < LookaheadSearch::MAX_DEPTH)
+                ++depth;
+            else if (beam < LookaheadSearch::MAX_BEAM)
+                beam *= 2;
+            else
+                break;
+            mResults.back() = { job, false, found, result };
+            mResults.publish();
+        }
+
+        if (!aborted)
+        {
+            mResults.back() = { job, true, found, result };
+            mResults.publish();
+        }
+    }
+}
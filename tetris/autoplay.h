@@ -0,0 +1,167 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "bot.h"
+#include "concurrent.h"
+#include "movegen.h"
+#include "tetris_core.h"
+
+// Looks ahead over the pieces a player can see: the active one, the next queue and the hold
+// slot. A beam search: each ply scores every placement of every position in the beam one ply
+// deep and keeps the best `beam` for the next, so a search costs about beam x depth move
+// generations. It never allocates.
+class LookaheadSearch final
+{
+public:
+    static constexpr int MAX_DEPTH = NEXT_PIECES_COUNT + 1;
+    static constexpr int MAX_BEAM = 64;
+
+    struct Result
+    {
+        bool hold;
+        // Where the first piece comes to rest.
+        Tetromino piece;
+        float score;
+    };
+
+    explicit LookaheadSearch(const Weights& weights) : mWeights(weights) { }
+
+    void setPosition(const GameSnapshot&);
+    // Searches up to `depth` pieces deep. Returns false, leaving result alone, if there is no
+    // placement that does not top out or if `abort` was raised before the search finished.
+    bool search(int depth, int beam, const std::atomic<bool>& abort, Result&);
+    uint64_t nodes() const { return mNodes; }
+
+private:
+    struct Pieces
+    {
+        int index;
+        bool holding;
+        TetrominoType held;
+    };
+
+    // A position in the beam and the first move that led to it.
+    struct Node
+    {
+        Playfield board;
+        Pieces pieces;
+        // Line clear rewards along the way.
+        float reward;
+        Result first;
+    };
+
+    // A placement from a position in the beam, ranked by the rewards so far plus its own score.
+    struct Child
+    {
+        float value;
+        float reward;
+        Tetromino piece;
+        bool hold;
+        int parent;
+    };
+
+    static constexpr float LOST = -1e9f;
+    static constexpr int MAX_CHILDREN = 2 * MoveGenerator::MAX_PLACEMENTS;
+
+    // Appends the placements of one position, then trims the children back to the best `beam`.
+    int expand(const Node&, int parent, int beam, int count);
+    int addChildren(const Playfield&, const Tetromino& start, bool hold, float reward, int parent, int count);
+    Pieces after(const Pieces&, bool hold) const;
+    float rewardOf(int cleared) const;
+
+    Weights mWeights;
+    Playfield mRoot;
+    Tetromino mActive;
+    std::array<TetrominoType, MAX_DEPTH> mQueue;
+    int mQueueSize = 0;
+    Pieces mRootPieces;
+    bool mCanHold = false;
+
+    MoveGenerator mGenerator;
+    BoardBatch mBatch;
+    BoardBatch::Result mBatchResult;
+    std::array<std::array<Node, MAX_BEAM>, 2> mBeams;
+    std::array<Child, MAX_BEAM + MAX_CHILDREN> mChildren;
+    uint64_t mNodes = 0;
+};
+
+// Plays the live game. Searches on its own thread, deepening for as long as a piece allows,
+// and hands the game thread one input at a time, at a human pace, from the best move found so
+// far. The faster gravity gets, the less time it thinks and the quicker it presses keys.
+class AutoPlayer final
+{
+public:
+    struct Settings
+    {
+        Weights weights = Weights::defaults();
+        uint64_t inputMicros = 50 * MICROS_PER_MILLISECOND;
+        uint64_t thinkMicros = 250 * MICROS_PER_MILLISECOND;
+    };
+
+    explicit AutoPlayer(const Settings&);
+    ~AutoPlayer();
+    AutoPlayer(const AutoPlayer&) = delete;
+    AutoPlayer& operator=(const AutoPlayer&) = delete;
+
+    // Called on the game's thread at simulation time `micros`; returns whether there is an input
+    // to apply now. Never waits for the search.
+    bool step(const GameContext&, uint64_t micros, Input&);
+    // Drops the current plan, for a new game.
+    void reset() { mPhase = Phase::Idle; }
+
+private:
+    // Gravity gets this many rows of time to think and a row's time for this many inputs.
+    static constexpr uint64_t THINK_ROWS = 2;
+    static constexpr uint64_t INPUTS_PER_ROW = 4;
+    static constexpr int FIRST_BEAM = 4;
+
+    enum class Phase { Idle, Thinking, Moving };
+
+    struct Published
+    {
+        uint64_t job = 0;
+        bool finished = false;
+        bool found = false;
+        LookaheadSearch::Result result;
+    };
+
+    void submit(const GameContext&);
+    void plan(const GameContext&);
+    void run();
+
+    Settings mSettings;
+
+    // Owned by the game's thread.
+    Phase mPhase = Phase::Idle;
+    uint64_t mJob = 0;
+    uint64_t mDeadline = 0;
+    uint64_t mNextInput = 0;
+    uint64_t mBoard = 0;
+    LookaheadSearch::Result mChosen;
+    bool mHoldPending = false;
+    bool mPlanned = false;
+    MoveGenerator mGenerator;
+    MoveGenerator::Path mPath;
+    int mPathIndex = 0;
+    Bot mFallback;
+
+    // Handed from the game's thread to the search thread.
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    GameSnapshot mPosition;
+    uint64_t mSubmitted = 0;
+    bool mStopping = false;
+    std::atomic<bool> mAbort { false };
+
+    // Handed back.
+    TripleBuffer<Published> mResults;
+
+    LookaheadSearch mSearch;
+    std::thread mThread;
+};
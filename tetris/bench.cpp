@@ -0,0 +1,427 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "autoplay.h"
+#include "board_batch.h"
+#include "bot.h"
+#include "league.h"
+#include "movegen.h"
+#include "perfect_clear.h"
+#include "tetris_core.h"
+#include "transposition.h"
+
+using namespace std;
+
+template <typename T>
+inline void doNotOptimize(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Rows are listed top to bottom and stacked onto the floor; '#' is filled.
+Playfield makePlayfield(const vector<const char*>& rows)
+{
+    Playfield playfield;
+    int row = CELL_ROWS - static_cast<int>(rows.size());
+    for (auto line : rows)
+    {
+        Playfield::Row bits = 0;
+        for (int column = 0; column != CELL_COLUMNS; ++column)
+        {
+            if (line[column] == '#')
+                bits |= 1 << column;
+        }
+        playfield.setRow(row++, bits, TetrominoType::I);
+    }
+    return playfield;
+}
+
+const Playfield EMPTY_BOARD = makePlayfield({});
+
+const Playfield MIDGAME_BOARD = makePlayfield({
+    "......#...",
+    "##...###..",
+    "###.####.#",
+    "####.###.#",
+    "#####.####",
+    "##.#######",
+    "####.#####",
+    "#.########",
+});
+
+const Playfield TALL_BOARD = makePlayfield({
+    "....#.....",
+    "..###.##..",
+    ".####.###.",
+    "#####.####",
+    "#.###.####",
+    "###.#.####",
+    "#####.##.#",
+    "####..####",
+    "##.##.####",
+    "#####.###.",
+    "###.#.####",
+    ".####.####",
+    "####..####",
+    "#####.##.#",
+    "#.###.####",
+    "####..####",
+});
+
+// The well in column 9 is cleared by a vertical I piece; `clears` rows are complete.
+Playfield makeClearBoard(int clears)
+{
+    vector<const char*> rows {
+        "#########.", "#########.", "#########.", "#########.",
+        "####.#####", "#####.####", "###.######", "######.###",
+    };
+    for (int i = 0; i != 4 - clears; ++i)
+        rows[3 - i] = "########..";
+    return makePlayfield(rows);
+}
+
+struct Result { string name; uint64_t iterations; double nsPerOp; };
+
+class Bench final
+{
+public:
+    explicit Bench(double minSeconds) : mMinSeconds(minSeconds) { }
+
+    void run(const string& name, const function<void (uint64_t)>& body);
+    void report(FILE* out) const;
+
+private:
+    double mMinSeconds;
+    vector<Result> mResults;
+};
+
+void Bench::run(const string& name, const function<void (uint64_t)>& body)
+{
+    using clock = chrono::steady_clock;
+
+    for (uint64_t iterations = 1000;; iterations *= 4)
+    {
+        auto start = clock::now();
+        body(iterations);
+        chrono::duration<double> elapsed = clock::now() - start;
+        if (elapsed.count() >= mMinSeconds || iterations > (1ull << 40))
+        {
+            mResults.push_back({ name, iterations, elapsed.count() * 1e9 / iterations });
+            return;
+        }
+    }
+}
+
+void Bench::report(FILE* out) const
+{
+    fprintf(out, "{\n  \"context\": { \"cell_columns\": %d, \"cell_rows\": %d },\n", CELL_COLUMNS, CELL_ROWS);
+    fprintf(out, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i != mResults.size(); ++i)
+    {
+        fprintf(out, "    { \"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f }%s\n",
+            mResults[i].name.c_str(), static_cast<unsigned long long>(mResults[i].iterations),
+            mResults[i].nsPerOp, i + 1 == mResults.size() ? "" : ",");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+// A board of any size with its bottom rows full but for one well, and a vertical I that
+// lands in the well to clear four of them.
+template <int Columns, int Rows>
+void runBoard(const function<void (const string&, const function<void (uint64_t)>&)>& run)
+{
+    using Board = BasicPlayfield<Columns, Rows>;
+    const string suffix = "/" + to_string(Columns) + "x" + to_string(Rows);
+    static Board fixture;
+    for (int row = Rows - 8; row != Rows; ++row)
+        fixture.setRow(row, Board::FULL_ROW & ~(typename Board::Row(1) << (Columns - 1)), TetrominoType::I);
+
+    auto well = Tetromino::of(TetrominoType::I, Columns);
+    well.state = Tetromino::Right;
+    well.left = Columns - 1;
+    well.bottom = 4;
+    const auto cells = fixture.getLandingSpot(well.split());
+
+    run("BasicPlayfield::getLandingSpot" + suffix, [&] (uint64_t n) {
+        for (uint64_t i = 0; i != n; ++i)
+        {
+            auto piece = Tetromino::of(static_cast<TetrominoType>(i % TETROMINO_TYPES), Columns);
+            doNotOptimize(fixture.getLandingSpot(piece.split(piece.left + i % 3 - 1, piece.bottom)));
+        }
+    });
+
+    static Board playfield;
+    run("BasicPlayfield::onLanding" + suffix, [&] (uint64_t n) {
+        for (uint64_t i = 0; i != n; ++i)
+        {
+            playfield = fixture;
+            doNotOptimize(playfield.onLanding(cells, TetrominoType::I));
+        }
+    });
+}
+
+// Spawned pieces of every type and state, as the controller sees them.
+vector<Tetromino> allPieces()
+{
+    vector<Tetromino> pieces;
+    for (int type = 0; type != TETROMINO_TYPES; ++type)
+    {
+        for (int state = 0; state != Tetromino::STATES_COUNT; ++state)
+        {
+            auto piece = Tetromino::of(static_cast<TetrominoType>(type));
+            piece.state = static_cast<Tetromino::State>(state);
+            piece.bottom = 6;
+            pieces.push_back(piece);
+        }
+    }
+    return pieces;
+}
+
+int main(int argc, char* argv[])
+{
+    double minSeconds = 0.2;
+    const char* filter = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+            minSeconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+    }
+
+    Bench bench(minSeconds);
+    auto run = [&] (const string& name, const function<void (uint64_t)>& body) {
+        if (!filter || name.find(filter) != string::npos)
+            bench.run(name, body);
+    };
+
+    const auto pieces = allPieces();
+    const vector<pair<const char*, const Playfield*>> boards {
+        { "empty", &EMPTY_BOARD }, { "midgame", &MIDGAME_BOARD }, { "tall", &TALL_BOARD },
+    };
+
+    run("Tetromino::split", [&] (uint64_t n) {
+        for (uint64_t i = 0; i != n; ++i)
+            doNotOptimize(pieces[i % pieces.size()].split());
+    });
+
+    MoveGenerator generator;
+    for (const auto& board : boards)
+    {
+        const auto& playfield = *board.second;
+
+        run(string("Playfield::isFilled/") + board.first, [&] (uint64_t n) {
+            for (uint64_t i = 0; i != n; ++i)
+            {
+                auto piece = pieces[i % pieces.size()];
+                doNotOptimize(playfield.isFilled(piece.split(piece.left + i % 3 - 1, piece.bottom + i % 13)));
+            }
+        });
+
+        run(string("Playfield::getLandingSpot/") + board.first, [&] (uint64_t n) {
+            for (uint64_t i = 0; i != n; ++i)
+            {
+                auto piece = pieces[i % pieces.size()];
+                doNotOptimize(playfield.getLandingSpot(piece.split(piece.left + i % 3 - 1, piece.bottom)));
+            }
+        });
+
+        vector<Tetromino> landed;
+        for (auto piece : pieces)
+        {
+            for (int shift = -1; shift <= 1; ++shift)
+            {
+                if (!piece.tryMove(playfield, shift, 0))
+                    continue;
+                while (piece.tryMove(playfield, 0, 1)) { }
+                landed.push_back(piece);
+            }
+        }
+
+        run(string("Tetromino::tryRotate/") + board.first, [&] (uint64_t n) {
+            for (uint64_t i = 0; i != n; ++i)
+            {
+                auto piece = landed[i % landed.size()];
+                doNotOptimize(piece.tryRotate(playfield));
+                doNotOptimize(piece);
+            }
+        });
+
+        run(string("MoveGenerator::generate/") + board.first, [&] (uint64_t n) {
+            for (uint64_t i = 0; i != n; ++i)
+                doNotOptimize(generator.generate(playfield, Tetromino::of(static_cast<TetrominoType>(i % TETROMINO_TYPES))));
+        });
+    }
+
+    for (int clears = 0; clears <= 4; ++clears)
+    {
+        const auto fixture = makeClearBoard(clears);
+        auto well = Tetromino::of(TetrominoType::I);
+        well.state = Tetromino::Right;
+        well.left = CELL_COLUMNS - 1;
+        well.bottom = CELL_ROWS - 4;
+        const auto cells = fixture.getLandingSpot(well.split());
+
+        run("Playfield::onLanding/clears_" + to_string(clears), [&] (uint64_t n) {
+            for (uint64_t i = 0; i != n; ++i)
+            {
+                auto playfield = fixture;
+                doNotOptimize(playfield.onLanding(cells, TetrominoType::I));
+                doNotOptimize(playfield);
+            }
+        });
+    }
+
+    run("Playfield::copy", [&] (uint64_t n) {
+        for (uint64_t i = 0; i != n; ++i)
+        {
+            auto playfield = MIDGAME_BOARD;
+            doNotOptimize(playfield);
+        }
+    });
+
+    Simulation simulation(1);
+    for (int i = 0; i != 20; ++i)
+        simulation.apply(Input::HardDrop);
+    GameSnapshot state;
+    simulation.context().snapshot(state);
+
+    run("GameContext::snapshot", [&] (uint64_t n) {
+        for (uint64_t i = 0; i != n; ++i)
+        {
+            simulation.context().snapshot(state);
+            doNotOptimize(state);
+        }
+    });
+
+    run("GameContext::restore", [&] (uint64_t n) {
+        for (uint64_t i = 0; i != n; ++i)
+        {
+            simulation.context().restore(state);
+            doNotOptimize(simulation);
+        }
+    });
+
+    Simulation midgame(1);
+    midgame.context().playfield() = MIDGAME_BOARD;
+    Bot bot(Weights::defaults());
+    Bot::Decision decision;
+    run("Bot::decide/midgame", [&] (uint64_t n) {
+        for (uint64_t i = 0; i != n; ++i)
+            doNotOptimize(bot.decide(midgame.context(), decision));
+    });
+
+    // Sixteen placements on the midgame board, scored together and one board at a time.
+    generator.generate(MIDGAME_BOARD, Tetromino::of(TetrominoType::T));
+    BoardBatch batch;
+    batch.reset(MIDGAME_BOARD);
+    for (int i = 0; i != generator.size() && batch.add(generator[i].piece.split()); ++i) { }
+    BoardBatch::Result batchResult;
+    run("BoardBatch::evaluate/16", [&] (uint64_t n) {
+        for (uint64_t i = 0; i != n; ++i)
+        {
+            batch.evaluate(batchResult);
+            doNotOptimize(batchResult);
+        }
+    });
+
+    run("BoardBatch::evaluateScalar/16", [&] (uint64_t n) {
+        for (uint64_t i = 0; i != n; ++i)
+        {
+            batch.evaluateScalar(batchResult);
+            doNotOptimize(batchResult);
+        }
+    });
+
+    run("featuresOf/16", [&] (uint64_t n) {
+        for (uint64_t i = 0; i != n; ++i)
+        {
+            for (int lane = 0; lane != batch.size(); ++lane)
+            {
+                auto landed = MIDGAME_BOARD;
+                const auto& piece = generator[lane].piece;
+                doNotOptimize(featuresOf(landed, landed.onLanding(piece.split(), piece.type)));
+            }
+        }
+    });
+
+    LookaheadSearch search(Weights::defaults());
+    search.setPosition(midgame.context().state());
+    const atomic<bool> never { false };
+    for (int beam : { 4, 16, 64 })
+    {
+        run("LookaheadSearch::search/midgame_beam_" + to_string(beam), [&] (uint64_t n) {
+            LookaheadSearch::Result result;
+            for (uint64_t i = 0; i != n; ++i)
+                doNotOptimize(search.search(LookaheadSearch::MAX_DEPTH, beam, never, result));
+        });
+    }
+
+    // A fresh bag every time, as the table would otherwise remember the last run's dead ends.
+    WorkStealingPool pool;
+    PerfectClearSolver solver(pool);
+
+    // Two rows missing an O: the clear takes fewer rows than `maxLines` and still has to count.
+    {
+        PerfectClearSolver::Problem problem;
+        for (int r = Playfield::ROWS - 2; r != Playfield::ROWS; ++r)
+            problem.playfield.setRow(r, Playfield::FULL_ROW & ~(Playfield::Row(3) << 4), TetrominoType::I);
+        problem.queue[problem.queueSize++] = TetrominoType::O;
+        PerfectClearSolver::Solution solution;
+        if (!solver.solve(problem, solution) || solution.length != 1)
+        {
+            fprintf(stderr, "PerfectClearSolver: missed a two-line clear\n");
+            return 1;
+        }
+    }
+
+    uint64_t bagSeed = 0;
+    run("PerfectClearSolver::solve/empty_4_lines", [&] (uint64_t n) {
+        for (uint64_t i = 0; i != n; ++i)
+        {
+            PerfectClearSolver::Problem problem;
+            TetrominoBag bag(++bagSeed);
+            for (problem.queueSize = 0; problem.queueSize != 11; ++problem.queueSize)
+                problem.queue[problem.queueSize] = bag.next();
+            PerfectClearSolver::Solution solution;
+            doNotOptimize(solver.solve(problem, solution));
+        }
+    });
+
+    // One tick is an update of every board; divide by the count for board-updates per second.
+    League::Settings leagueSettings;
+    League league(pool, leagueSettings);
+    run("League::tick/" + to_string(leagueSettings.boards) + "_boards", [&] (uint64_t n) {
+        for (uint64_t i = 0; i != n; ++i)
+            league.tick();
+    });
+
+    run("TetrominoController::make", [&] (uint64_t n) {
+        TetrominoBag bag;
+        for (uint64_t i = 0; i != n; ++i)
+            doNotOptimize(Tetromino::of(bag.next()));
+    });
+
+    runBoard<4, 8>(run);
+    runBoard<64, 64>(run);
+    runBoard<16, 1024>(run);
+
+    TranspositionTable table(16 << 20);
+    run("TranspositionTable::store", [&] (uint64_t n) {
+        for (uint64_t i = 0; i != n; ++i)
+            table.store(i * 0x9E3779B97F4A7C15ull, { static_cast<int32_t>(i), 0, static_cast<uint8_t>(i & 7) });
+    });
+
+    run("TranspositionTable::probe", [&] (uint64_t n) {
+        TranspositionTable::Entry entry;
+        for (uint64_t i = 0; i != n; ++i)
+            doNotOptimize(table.probe(i * 0x9E3779B97F4A7C15ull, entry));
+    });
+
+    bench.report(stdout);
+}
@@ -0,0 +1,196 @@
+#include "board_batch.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+
+constexpr int COLUMNS = Playfield::COLUMNS;
+constexpr int ROWS = Playfield::ROWS;
+constexpr int FULL_ROW = Playfield::FULL_ROW;
+// Bits of a row with a filled wall either side, and the pairs of neighbours among them.
+constexpr int WALLS = 1 | 1 << (COLUMNS + 1);
+constexpr int WALLED_PAIRS = (1 << (COLUMNS + 1)) - 1;
+
+// GCC vector extensions: plain operators, compiled to whatever the enclosing function targets.
+// Vectors only pass by reference, since passing them by value depends on the target's ABI.
+typedef int16_t Lanes __attribute__((vector_size(2 * BoardBatch::LANES)));
+
+inline __attribute__((always_inline)) void addPopcount(Lanes& sum, const Lanes& bits)
+{
+    auto x = bits - (bits >> 1 & 0x5555);
+    x = (x & 0x3333) + (x >> 2 & 0x3333);
+    x = (x + (x >> 4)) & 0x0F0F;
+    sum += (x + (x >> 8)) & 0x1F;
+}
+
+inline __attribute__((always_inline)) void minimum(Lanes& into, const Lanes& a, const Lanes& b)
+{
+    Lanes less = a < b;
+    into = (a & less) | (b & ~less);
+}
+
+inline __attribute__((always_inline)) void maximum(Lanes& into, const Lanes& a, const Lanes& b)
+{
+    Lanes less = a < b;
+    into = (b & less) | (a & ~less);
+}
+
+// Top to bottom, skipping full rows as if they were already cleared: a column counts towards
+// its height, and its empty cells towards holes, in every remaining row from its top down.
+inline __attribute__((always_inline)) void evaluateLanes(const Playfield::Row* rows, BoardBatch::Result& result)
+{
+    const Lanes zero = { };
+    Lanes covered = zero;
+    Lanes holes = zero;
+    Lanes transitions = zero;
+    Lanes cleared = zero;
+    Lanes heights[COLUMNS];
+    for (auto& height : heights)
+        height = zero;
+
+    for (int r = 0; r != ROWS; ++r)
+    {
+        Lanes row;
+        memcpy(&row, rows + r * BoardBatch::LANES, sizeof(row));
+        Lanes open = ~(row == FULL_ROW);
+        cleared -= ~open;
+        covered |= row & open;
+        addPopcount(holes, covered & ~row & open);
+
+        Lanes walled = row << 1 | WALLS;
+        addPopcount(transitions, (walled ^ walled >> 1) & WALLED_PAIRS & open);
+        for (int c = 0; c != COLUMNS; ++c)
+            heights[c] += covered >> c & 1 & open;
+    }
+    // The cleared rows come back as empty rows at the top, each with a transition at either wall.
+    transitions += cleared * 2;
+
+    Lanes aggregate = zero;
+    Lanes maxHeight = zero;
+    Lanes bumpiness = zero;
+    Lanes wells = zero;
+    const Lanes walls = zero + ROWS;
+    for (int c = 0; c != COLUMNS; ++c)
+    {
+        aggregate += heights[c];
+        maximum(maxHeight, maxHeight, heights[c]);
+        if (c > 0)
+        {
+            Lanes step = heights[c] - heights[c - 1];
+            Lanes sign = step >> 15;
+            bumpiness += (step ^ sign) - sign;
+        }
+
+        Lanes lower;
+        minimum(lower, c == 0 ? walls : heights[c - 1], c == COLUMNS - 1 ? walls : heights[c + 1]);
+        Lanes depth = lower - heights[c];
+        wells += depth & ~(depth >> 15);
+    }
+
+    memcpy(result.aggregateHeight.data(), &aggregate, sizeof(aggregate));
+    memcpy(result.maxHeight.data(), &maxHeight, sizeof(maxHeight));
+    memcpy(result.holes.data(), &holes, sizeof(holes));
+    memcpy(result.bumpiness.data(), &bumpiness, sizeof(bumpiness));
+    memcpy(result.wells.data(), &wells, sizeof(wells));
+    memcpy(result.rowTransitions.data(), &transitions, sizeof(transitions));
+    memcpy(result.cleared.data(), &cleared, sizeof(cleared));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) void evaluateAvx2(const Playfield::Row* rows, BoardBatch::Result& result)
+{
+    evaluateLanes(rows, result);
+}
+
+const bool HAS_AVX2 = __builtin_cpu_supports("avx2");
+#endif
+
+}
+
+void BoardBatch::reset(const Playfield& playfield)
+{
+    for (int r = 0; r != ROWS; ++r)
+    {
+        mBase[r] = playfield.row(r);
+        mRows[r].fill(mBase[r]);
+    }
+    mSize = 0;
+}
+
+bool BoardBatch::add(const Cells& cells)
+{
+    if (mSize == LANES)
+        return false;
+    for (const auto& cell : cells)
+        mRows[cell.row][mSize] |= static_cast<Playfield::Row>(1 << cell.column);
+    ++mSize;
+    return true;
+}
+
+void BoardBatch::evaluate(Result& result) const
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (HAS_AVX2)
+    {
+        evaluateAvx2(mRows[0].data(), result);
+        return;
+    }
+#endif
+    evaluateLanes(mRows[0].data(), result);
+}
+
+void BoardBatch::evaluateScalar(Result& result) const
+{
+    for (int lane = 0; lane != LANES; ++lane)
+    {
+        array<int, COLUMNS> heights {};
+        int holes = 0;
+        int transitions = 0;
+        int cleared = 0;
+        int covered = 0;
+        for (int r = 0; r != ROWS; ++r)
+        {
+            int row = mRows[r][lane];
+            if (row == FULL_ROW)
+            {
+                ++cleared;
+                continue;
+            }
+            covered |= row;
+            holes += __builtin_popcount(covered & ~row);
+            int walled = row << 1 | WALLS;
+            transitions += __builtin_popcount((walled ^ walled >> 1) & WALLED_PAIRS);
+            for (int c = 0; c != COLUMNS; ++c)
+                heights[c] += covered >> c & 1;
+        }
+        transitions += cleared * __builtin_popcount(WALLS);
+
+        int aggregate = 0;
+        int maxHeight = 0;
+        int bumpiness = 0;
+        int wells = 0;
+        for (int c = 0; c != COLUMNS; ++c)
+        {
+            aggregate += heights[c];
+            maxHeight = max(maxHeight, heights[c]);
+            if (c > 0)
+                bumpiness += abs(heights[c] - heights[c - 1]);
+            int left = c == 0 ? ROWS : heights[c - 1];
+            int right = c == COLUMNS - 1 ? ROWS : heights[c + 1];
+            wells += max(min(left, right) - heights[c], 0);
+        }
+
+        result.aggregateHeight[lane] = static_cast<int16_t>(aggregate);
+        result.maxHeight[lane] = static_cast<int16_t>(maxHeight);
+        result.holes[lane] = static_cast<int16_t>(holes);
+        result.bumpiness[lane] = static_cast<int16_t>(bumpiness);
+        result.wells[lane] = static_cast<int16_t>(wells);
+        result.rowTransitions[lane] = static_cast<int16_t>(transitions);
+        result.cleared[lane] = static_cast<int16_t>(cleared);
+    }
+}
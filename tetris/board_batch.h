@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "tetris_core.h"
+
+// Up to 16 copies of one board, each with a candidate piece's cells filled in, stored row by
+// row across the batch so that the same row of every board fills one 256-bit vector. The
+// features of all of them come out of a single pass over the rows, as Playfield would have
+// them once the piece landed and its full rows were cleared.
+class BoardBatch final
+{
+public:
+    static constexpr int LANES = 16;
+    static_assert(sizeof(Playfield::Row) == 2, "a row is one 16-bit lane");
+
+    struct Result
+    {
+        using Lanes = std::array<int16_t, LANES>;
+        Lanes aggregateHeight;
+        Lanes maxHeight;
+        Lanes holes;
+        Lanes bumpiness;
+        Lanes wells;
+        Lanes rowTransitions;
+        Lanes cleared;
+    };
+
+    // Starts a batch of candidates on this board.
+    void reset(const Playfield&);
+    // Returns false when the batch is full.
+    bool add(const Cells&);
+    int size() const { return mSize; }
+
+    // Vectorized, with AVX2 when the CPU has it; lanes past size() hold the bare board.
+    void evaluate(Result&) const;
+    // One board at a time, for checking the vector paths against.
+    void evaluateScalar(Result&) const;
+
+private:
+    std::array<std::array<Playfield::Row, LANES>, Playfield::ROWS> mRows;
+    std::array<Playfield::Row, Playfield::ROWS> mBase;
+    int mSize = 0;
+};
@@ -0,0 +1,133 @@
+#include "bot.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+using namespace std;
+
+Features featuresOf(const Playfield& playfield, int cleared)
+{
+    Features features {};
+    int aggregate = 0;
+    int maxHeight = 0;
+    int bumpiness = 0;
+    int wells = 0;
+    for (int column = 0; column != Playfield::COLUMNS; ++column)
+    {
+        int height = playfield.height(column);
+        aggregate += height;
+        maxHeight = max(maxHeight, height);
+        wells += playfield.wellDepth(column);
+        if (column > 0)
+            bumpiness += abs(height - playfield.height(column - 1));
+    }
+
+    features[static_cast<int>(Feature::AggregateHeight)] = aggregate;
+    features[static_cast<int>(Feature::MaxHeight)] = maxHeight;
+    features[static_cast<int>(Feature::Holes)] = playfield.holes();
+    features[static_cast<int>(Feature::Bumpiness)] = bumpiness;
+    features[static_cast<int>(Feature::Wells)] = wells;
+    features[static_cast<int>(Feature::RowTransitions)] = playfield.rowTransitions();
+    if (cleared > 0)
+        features[static_cast<int>(Feature::Singles) + cleared - 1] = 1;
+    return features;
+}
+
+Features featuresOf(const BoardBatch::Result& result, int lane)
+{
+    Features features {};
+    features[static_cast<int>(Feature::AggregateHeight)] = result.aggregateHeight[lane];
+    features[static_cast<int>(Feature::MaxHeight)] = result.maxHeight[lane];
+    features[static_cast<int>(Feature::Holes)] = result.holes[lane];
+    features[static_cast<int>(Feature::Bumpiness)] = result.bumpiness[lane];
+    features[static_cast<int>(Feature::Wells)] = result.wells[lane];
+    features[static_cast<int>(Feature::RowTransitions)] = result.rowTransitions[lane];
+    if (result.cleared[lane] > 0)
+        features[static_cast<int>(Feature::Singles) + result.cleared[lane] - 1] = 1;
+    return features;
+}
+
+Weights Weights::defaults()
+{
+    return { {
+        -0.51f, 0.0f, -0.36f, -0.18f, -0.1f, -0.1f,
+        0.76f, 1.52f, 2.28f, 3.04f,
+    } };
+}
+
+float Weights::evaluate(const Features& features) const
+{
+    float score = 0;
+    for (int i = 0; i != FEATURES_COUNT; ++i)
+        score += values[i] * features[i];
+    return score;
+}
+
+bool Bot::decide(const GameContext& context, Decision& decision)
+{
+    decision.score = -numeric_limits<float>::infinity();
+    decision.path.length = 0;
+    decision.truncated = false;
+
+    const auto& controller = context.controller();
+    consider(context.playfield(), controller.active(), false, decision);
+    if (controller.canHold())
+    {
+        // The piece hold brings in and where it spawns come from the real rules.
+        mScratch.restore(context.state());
+        mScratch.apply(Input::Hold);
+        consider(context.playfield(), mScratch.controller().active(), true, decision);
+    }
+    return decision.path.length != 0;
+}
+
+bool Bot::play(GameContext& context)
+{
+    Decision decision;
+    if (!decide(context, decision))
+        return false;
+
+    if (decision.hold)
+        context.apply(Input::Hold);
+    for (int i = 0; i != decision.path.length; ++i)
+        context.apply(decision.path.inputs[i]);
+    return true;
+}
+
+void Bot::consider(const Playfield& playfield, const Tetromino& start, bool hold, Decision& decision)
+{
+    const MoveGenerator::Placement* best = nullptr;
+    array<const MoveGenerator::Placement*, BoardBatch::LANES> lanes;
+    mGenerator.generate(playfield, start);
+    decision.truncated = decision.truncated || mGenerator.truncated();
+    for (auto placement = mGenerator.begin(); placement != mGenerator.end();)
+    {
+        mBatch.reset(playfield);
+        for (; placement != mGenerator.end() && mBatch.size() != BoardBatch::LANES; ++placement)
+        {
+            if (!placement->piece.visiable())
+                continue;
+            lanes[mBatch.size()] = placement;
+            mBatch.add(placement->piece.split());
+        }
+
+        mBatch.evaluate(mBatchResult);
+        for (int lane = 0; lane != mBatch.size(); ++lane)
+        {
+            auto score = mWeights.evaluate(featuresOf(mBatchResult, lane));
+            if (score > decision.score)
+            {
+                decision.score = score;
+                best = lanes[lane];
+            }
+        }
+    }
+
+    if (best)
+    {
+        decision.hold = hold;
+        decision.piece = best->piece;
+        mGenerator.path(*best, decision.path);
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "board_batch.h"
+#include "movegen.h"
+#include "tetris_core.h"
+
+// The board features a placement leaves behind, read off the playfield's incremental metrics.
+enum class Feature
+{
+    AggregateHeight, MaxHeight, Holes, Bumpiness, Wells, RowTransitions,
+    Singles, Doubles, Triples, Tetrises,
+};
+constexpr int FEATURES_COUNT = 10;
+
+using Features = std::array<int, FEATURES_COUNT>;
+Features featuresOf(const Playfield&, int cleared);
+// The same features for one board of a batch.
+Features featuresOf(const BoardBatch::Result&, int lane);
+
+// A linear evaluation: a board scores the weighted sum of its features, higher is better.
+struct Weights
+{
+    std::array<float, FEATURES_COUNT> values;
+
+    static Weights defaults();
+    float& operator[](Feature feature) { return values[static_cast<int>(feature)]; }
+    float operator[](Feature feature) const { return values[static_cast<int>(feature)]; }
+    float evaluate(const Features&) const;
+};
+
+// Plays one piece at a time: the best placement of the active piece, or of the piece hold
+// would bring in, scored one ply deep with placements evaluated in batches. Moves go through
+// GameContext::apply like a player's.
+class Bot final
+{
+public:
+    struct Decision
+    {
+        bool hold;
+        Tetromino piece;
+        MoveGenerator::Path path;
+        float score;
+        // Some placement may have been missed; see MoveGenerator::truncated().
+        bool truncated;
+    };
+
+    explicit Bot(const Weights& weights) : mWeights(weights), mScratch(mClock) { }
+
+    const Weights& weights() const { return mWeights; }
+    // Returns false when every placement tops out.
+    bool decide(const GameContext&, Decision&);
+    // Decides and applies the decision's inputs; returns false when there was nothing to play.
+    bool play(GameContext&);
+
+private:
+    void consider(const Playfield&, const Tetromino& start, bool hold, Decision&);
+
+    Weights mWeights;
+    ManualClock mClock;
+    GameContext mScratch;
+    MoveGenerator mGenerator;
+    BoardBatch mBatch;
+    BoardBatch::Result mBatchResult;
+};
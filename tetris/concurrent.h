@@ -0,0 +1,70 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Single producer, single consumer. The producer fills back() and publishes it;
+// the consumer picks up the newest published value. Neither side ever waits.
+template <typename T>
+class TripleBuffer final
+{
+public:
+    T& back() { return mSlots[mBack]; }
+    const T& front() const { return mSlots[mFront]; }
+
+    void publish()
+    {
+        mBack = mMiddle.exchange(mBack | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Returns whether front() moved to a newer value.
+    bool update()
+    {
+        if (!(mMiddle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        mFront = mMiddle.exchange(mFront, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+private:
+    static constexpr uint8_t INDEX = 3;
+    static constexpr uint8_t FRESH = 4;
+
+    std::array<T, 3> mSlots;
+    uint8_t mBack = 0;
+    std::atomic<uint8_t> mMiddle { 1 };
+    uint8_t mFront = 2;
+};
+
+// Bounded single producer, single consumer queue; push fails instead of blocking when full.
+template <typename T, size_t N>
+class SpscQueue final
+{
+public:
+    bool push(const T& item)
+    {
+        auto tail = mTail.load(std::memory_order_relaxed);
+        if (tail - mHead.load(std::memory_order_acquire) == N)
+            return false;
+        mItems[tail % N] = item;
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        auto head = mHead.load(std::memory_order_relaxed);
+        if (head == mTail.load(std::memory_order_acquire))
+            return false;
+        item = mItems[head % N];
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array<T, N> mItems;
+    std::atomic<size_t> mHead { 0 };
+    std::atomic<size_t> mTail { 0 };
+};
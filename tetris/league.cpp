@@ -0,0 +1,112 @@
+#include "league.h"
+
+using namespace std;
+
+League::League(WorkStealingPool& pool, const Settings& settings) : mPool(pool), mSettings(settings), mSeeds(settings.seed)
+{
+    if (mSettings.entrants.empty())
+        mSettings.entrants.push_back(Weights::defaults());
+    for (int i = 0; i != max(settings.boards, 1); ++i)
+        mBoards.emplace_back(new Board(mSettings.entrants[i % mSettings.entrants.size()]));
+    for (int i = 0; i < size(); i += 2)
+        startMatch(i);
+}
+
+void League::assign(int board, const Replay& replay)
+{
+    mBoards[board]->replay = &replay;
+    mBoards[board]->player.reset(new ReplayPlayer(replay));
+    startMatch(board - board % 2);
+}
+
+void League::tick()
+{
+    mPool.run(mBoards.size(), [this] (size_t index, int) { update(*mBoards[index]); });
+
+    ++mStats.ticks;
+    mStats.updates += mBoards.size();
+    for (const auto& board : mBoards)
+        mStats.pieces += static_cast<uint64_t>(board->placed);
+    for (int i = 0; i < size(); i += 2)
+    {
+        auto& first = *mBoards[i];
+        if (i + 1 == size())
+        {
+            if (first.simulation.gameOver() || first.pieces >= mSettings.maxPieces)
+                startMatch(i);
+            continue;
+        }
+
+        auto& second = *mBoards[i + 1];
+        deliver(first, second);
+        deliver(second, first);
+
+        bool firstOver = first.simulation.gameOver();
+        bool secondOver = second.simulation.gameOver();
+        bool draw = first.pieces >= mSettings.maxPieces && second.pieces >= mSettings.maxPieces;
+        if (!firstOver && !secondOver && !draw)
+            continue;
+
+        // Topping out on the same tick is a draw too.
+        if (firstOver != secondOver)
+            ++(firstOver ? second : first).wins;
+        else
+            ++mStats.draws;
+        ++mStats.matches;
+        startMatch(i);
+    }
+}
+
+void League::update(Board& board)
+{
+    auto& simulation = board.simulation;
+    board.placed = 0;
+    if (simulation.gameOver() || board.pieces >= mSettings.maxPieces)
+        return;
+
+    uint64_t until = simulation.now() + mSettings.tickMicros;
+    if (board.player)
+        board.player->advanceTo(simulation, until);
+    else
+        board.bot.play(simulation.context());
+    if (!simulation.gameOver() && simulation.now() < until)
+        simulation.advanceMicros(until - simulation.now());
+
+    int pieces = static_cast<int>(simulation.context().controller().landed());
+    board.placed = pieces - board.pieces;
+    board.pieces = pieces;
+}
+
+void League::deliver(Board& from, Board& to)
+{
+    uint32_t sent = from.simulation.context().controller().garbageSent();
+    int lines = static_cast<int>(sent - from.delivered);
+    from.delivered = sent;
+    if (lines == 0)
+        return;
+    to.simulation.context().controller().receiveGarbage(lines);
+    mStats.garbage += static_cast<uint64_t>(lines);
+}
+
+void League::startMatch(int first)
+{
+    uint64_t seed = splitMix64(mSeeds);
+    int last = min(first + 2, size());
+    for (int i = first; i != last; ++i)
+    {
+        if (mBoards[i]->replay)
+            seed = mBoards[i]->replay->seed;
+    }
+
+    for (int i = first; i != last; ++i)
+    {
+        auto& board = *mBoards[i];
+        if (board.player)
+            board.player->start(board.simulation);
+        else
+            board.simulation.reset(seed);
+        board.simulation.context().controller().seedGarbage(splitMix64(mSeeds));
+        board.pieces = 0;
+        board.delivered = 0;
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "bot.h"
+#include "replay.h"
+#include "tetris_core.h"
+#include "thread_pool.h"
+
+// Hosts many versus matches at once: boards 2k and 2k + 1 play each other, both on the same
+// pieces but each with its own garbage gaps, and what one sends rises on the other. Every tick
+// advances all boards across the pool, each worker starting on the same contiguous shard as the
+// tick before. A board's update touches nothing but that board; sent lines are handed over and
+// finished matches restarted between ticks, on the calling thread.
+class League final
+{
+public:
+    struct Settings
+    {
+        int boards = 256;
+        uint64_t seed = 1;
+        // Game time per tick. A bot places one piece every tick, however short.
+        uint64_t tickMicros = 100 * MICROS_PER_MILLISECOND;
+        // A match where both boards have placed this many pieces is a draw.
+        int maxPieces = 1000;
+        // Board i's bot plays with entrants[i % entrants.size()], so with two entrants every
+        // match is one against the other.
+        std::vector<Weights> entrants { Weights::defaults() };
+    };
+
+    struct Stats
+    {
+        uint64_t ticks = 0;
+        uint64_t updates = 0;
+        uint64_t pieces = 0;
+        uint64_t garbage = 0;
+        uint64_t matches = 0;
+        uint64_t draws = 0;
+    };
+
+    League(WorkStealingPool&, const Settings&);
+
+    // The board plays this replay's inputs instead of its bot, starting over with a new match
+    // against the same opponent. The opponent plays the replay's pieces; when both boards of a
+    // pair replay, each keeps its own. A replay that runs out of inputs leaves its board to
+    // gravity. The replay must outlive the league.
+    void assign(int board, const Replay&);
+    void tick();
+
+    int size() const { return static_cast<int>(mBoards.size()); }
+    const Stats& stats() const { return mStats; }
+    int wins(int board) const { return mBoards[board]->wins; }
+
+private:
+    struct Board
+    {
+        explicit Board(const Weights& weights) : bot(weights) { }
+
+        Simulation simulation;
+        Bot bot;
+        const Replay* replay = nullptr;
+        std::unique_ptr<ReplayPlayer> player;
+        // Pieces this match, bot or replay, and how many the last update put down.
+        int pieces = 0;
+        int placed = 0;
+        // Garbage already handed to the opponent.
+        uint32_t delivered = 0;
+        int wins = 0;
+    };
+
+    void update(Board&);
+    void deliver(Board& from, Board& to);
+    void startMatch(int first);
+
+    WorkStealingPool& mPool;
+    Settings mSettings;
+    uint64_t mSeeds;
+    std::vector<std::unique_ptr<Board>> mBoards;
+    Stats mStats;
+};
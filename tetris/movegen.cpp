@@ -0,0 +1,186 @@
+#include "movegen.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+
+// The cells' board indices, sorted and packed; equal keys are the same placement.
+uint64_t keyOf(const Cells& cells)
+{
+    static_assert(CELL_ROWS * CELL_COLUMNS <= 0xFFFF, "board indices are packed as 16 bits");
+    array<uint64_t, 4> indices;
+    for (int i = 0; i != 4; ++i)
+        indices[i] = static_cast<uint64_t>(cells[i].row * CELL_COLUMNS + cells[i].column);
+    sort(indices.begin(), indices.end());
+    return indices[0] | indices[1] << 16 | indices[2] << 32 | indices[3] << 48;
+}
+
+}
+
+Tetromino MoveGenerator::pieceOf(int node) const
+{
+    Tetromino piece;
+    piece.type = mType;
+    piece.state = static_cast<Tetromino::State>(node % Tetromino::STATES_COUNT);
+    node /= Tetromino::STATES_COUNT;
+    piece.left = static_cast<int16_t>(node % LEFTS - LEFT_OFFSET);
+    piece.bottom = static_cast<int16_t>(node / LEFTS);
+    return piece;
+}
+
+void MoveGenerator::prepare(const Playfield& playfield, TetrominoType type)
+{
+    constexpr uint32_t WALLS = ~(static_cast<uint32_t>(Playfield::FULL_ROW) << WALL);
+    mRows.fill(~0u);
+    for (int r = 0; r != CELL_ROWS; ++r)
+        mRows[r + 4] = WALLS | static_cast<uint32_t>(playfield.row(r)) << WALL;
+
+    mType = type;
+    for (int state = 0; state != Tetromino::STATES_COUNT; ++state)
+    {
+        mMasks[state].fill(0);
+        for (const auto cell : TETROMINO_SHAPES[static_cast<int>(type)][state].cells)
+            mMasks[state][cell.row + 4] |= 1u << cell.column;
+    }
+}
+
+// Same answer as Playfield::isFilled on the piece's cells, without building them.
+inline bool MoveGenerator::fits(int left, int bottom, int state) const
+{
+    if (left < -LEFT_OFFSET || left >= CELL_COLUMNS || bottom < 0 || bottom >= BOTTOMS)
+        return false;
+
+    const auto& masks = mMasks[state];
+    int shift = left + WALL;
+    const auto rows = &mRows[bottom];
+    return !((rows[0] & masks[0] << shift) | (rows[1] & masks[1] << shift)
+        | (rows[2] & masks[2] << shift) | (rows[3] & masks[3] << shift));
+}
+
+// Tetromino::tryRotate with the same kick order, checked against the prepared rows.
+bool MoveGenerator::tryRotate(Tetromino& piece) const
+{
+    auto nextState = static_cast<Tetromino::State>((piece.state + 1) % Tetromino::STATES_COUNT);
+    const auto& kicks = piece.kicksInto(nextState);
+    int leftBase = piece.left + kicks.offset.column;
+    int bottomBase = piece.bottom + kicks.offset.row;
+
+    for (int i = 0; i != kicks.count; ++i)
+    {
+        int left = leftBase + kicks.attempts[i].column;
+        int bottom = bottomBase + kicks.attempts[i].row;
+        if (fits(left, bottom, nextState))
+        {
+            piece.left = static_cast<int16_t>(left);
+            piece.bottom = static_cast<int16_t>(bottom);
+            piece.state = nextState;
+            return true;
+        }
+    }
+    return false;
+}
+
+int MoveGenerator::generate(const Playfield& playfield, const Tetromino& start)
+{
+    mCount = 0;
+    mTruncated = false;
+    if (!inRange(start) || playfield.isFilled(start.split()))
+        return 0;
+    prepare(playfield, start.type);
+
+    mDistance.fill(UNSEEN);
+    int head = 0, tail = 0;
+    int first = indexOf(start);
+    mDistance[first] = 0;
+    mQueue[tail++] = static_cast<uint16_t>(first);
+
+    // Soft drop goes last so that, among equally short paths, drops come as late as possible.
+    auto visit = [&] (int next, int from, Input input, uint16_t distance) {
+        if (mDistance[next] != UNSEEN)
+            return;
+        mDistance[next] = distance;
+        mParent[next] = static_cast<uint16_t>(from);
+        mVia[next] = input;
+        mQueue[tail++] = static_cast<uint16_t>(next);
+    };
+    while (head != tail)
+    {
+        int node = mQueue[head++];
+        auto distance = static_cast<uint16_t>(mDistance[node] + 1);
+        auto piece = pieceOf(node);
+        mCanDrop[node] = fits(piece.left, piece.bottom + 1, piece.state);
+        if (distance + 1 >= MAX_PATH)
+        {
+            mTruncated = true;
+            continue;
+        }
+
+        if (fits(piece.left - 1, piece.bottom, piece.state))
+            visit(node - Tetromino::STATES_COUNT, node, Input::MoveLeft, distance);
+        if (fits(piece.left + 1, piece.bottom, piece.state))
+            visit(node + Tetromino::STATES_COUNT, node, Input::MoveRight, distance);
+        if (tryRotate(piece))
+            visit(indexOf(piece), node, Input::Rotate, distance);
+        if (mCanDrop[node])
+            visit(node + ROW, node, Input::SoftDrop, distance);
+    }
+
+    // Where a hard drop from each node lands. Walking from the highest index down resolves
+    // the node one row lower first; it is always reached unless the path cap cut it off.
+    for (int node = NODES - 1; node >= 0; --node)
+    {
+        if (mDistance[node] == UNSEEN)
+            continue;
+        if (!mCanDrop[node])
+            mRest[node] = static_cast<uint16_t>(node);
+        else
+            mRest[node] = node + ROW < NODES && mDistance[node + ROW] != UNSEEN ? mRest[node + ROW] : UNSEEN;
+    }
+
+    // The queue is in order of distance, so the first node to reach a placement is the closest.
+    array<uint64_t, MAX_PLACEMENTS> keys;
+    mClaimed.fill(false);
+    for (int i = 0; i != tail; ++i)
+    {
+        int node = mQueue[i];
+        int rest = mRest[node];
+        if (rest == UNSEEN || mClaimed[rest])
+            continue;
+        mClaimed[rest] = true;
+
+        auto piece = pieceOf(rest);
+        auto key = keyOf(piece.split());
+        if (find(keys.begin(), keys.begin() + mCount, key) != keys.begin() + mCount)
+            continue;
+        if (mCount == MAX_PLACEMENTS)
+        {
+            mTruncated = true;
+            break;
+        }
+        keys[mCount] = key;
+        mPlacements[mCount++] = { piece, static_cast<uint16_t>(mDistance[node] + 1), static_cast<uint16_t>(node) };
+    }
+    return mCount;
+}
+
+void MoveGenerator::path(const Placement& placement, Path& path) const
+{
+    path.length = placement.inputs;
+    path.inputs[path.length - 1] = Input::HardDrop;
+    for (int node = placement.node, i = path.length - 2; i >= 0; node = mParent[node], --i)
+        path.inputs[i] = mVia[node];
+}
+
+const MoveGenerator::Placement* MoveGenerator::placementOf(const Tetromino& landed) const
+{
+    auto key = keyOf(landed.split());
+    for (const auto& placement : *this)
+    {
+        if (keyOf(placement.piece.split()) == key)
+            return &placement;
+    }
+    return nullptr;
+}
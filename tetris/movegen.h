@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "tetris_core.h"
+
+// Every resting place a piece can reach, found by a breadth-first search over
+// (left, bottom, state) using the game's own moves: shifts, one-row soft drops and
+// rotations with their kicks, so tucks, slides and kick spins are all included.
+// A placement's path is the fewest inputs that reach it, ending in a hard drop.
+class MoveGenerator final
+{
+public:
+    // Both caps are fixed so that nothing allocates. A path from the spawn to the floor of an
+    // empty board takes about 30 inputs and self-play never needs more than 50; a piece has
+    // at most 40 (left, state) columns to drop down, and only overhangs add placements beyond
+    // those. Either cap cutting the search short sets truncated().
+    static constexpr int MAX_PATH = 96;
+    static constexpr int MAX_PLACEMENTS = 256;
+
+    struct Placement
+    {
+        Tetromino piece;
+        uint16_t inputs;
+        uint16_t node;
+    };
+
+    struct Path
+    {
+        std::array<Input, MAX_PATH> inputs;
+        int length;
+    };
+
+    // Placements stay valid until the next call.
+    int generate(const Playfield&, const Tetromino& start);
+
+    int size() const { return mCount; }
+    // Whether the last call hit MAX_PATH or MAX_PLACEMENTS, so a reachable placement may be missing.
+    bool truncated() const { return mTruncated; }
+    const Placement& operator[](int i) const { return mPlacements[i]; }
+    const Placement* begin() const { return mPlacements.data(); }
+    const Placement* end() const { return mPlacements.data() + mCount; }
+
+    void path(const Placement&, Path&) const;
+    // The placement that fills the same cells as `landed`, or null if it is not reachable.
+    const Placement* placementOf(const Tetromino& landed) const;
+
+private:
+    static constexpr int LEFT_OFFSET = 3;
+    static constexpr int LEFTS = CELL_COLUMNS + LEFT_OFFSET;
+    static constexpr int BOTTOMS = CELL_ROWS + 1;
+    static constexpr int ROW = LEFTS * Tetromino::STATES_COUNT;
+    static constexpr int NODES = BOTTOMS * ROW;
+    static constexpr uint16_t UNSEEN = 0xFFFF;
+
+    // Ordered by bottom first, so a node's soft drop always has a higher index.
+    static int indexOf(const Tetromino& piece)
+    {
+        return (piece.bottom * LEFTS + piece.left + LEFT_OFFSET) * Tetromino::STATES_COUNT + piece.state;
+    }
+    static bool inRange(const Tetromino& piece)
+    {
+        return piece.bottom >= 0 && piece.bottom < BOTTOMS && piece.left >= -LEFT_OFFSET && piece.left < CELL_COLUMNS;
+    }
+    Tetromino pieceOf(int node) const;
+    void prepare(const Playfield&, TetrominoType);
+    bool fits(int left, int bottom, int state) const;
+    bool tryRotate(Tetromino&) const;
+
+    // The board as 32-bit rows with walls set around it, so a piece fits exactly when its
+    // shifted row masks miss every set bit. Row r of the board is mRows[r + 4].
+    static constexpr int WALL = 4;
+    static_assert(CELL_COLUMNS + 2 * WALL <= 32, "walled rows are 32 bits");
+    std::array<uint32_t, CELL_ROWS + 8> mRows;
+    std::array<std::array<uint32_t, 4>, Tetromino::STATES_COUNT> mMasks;
+
+    TetrominoType mType;
+    std::array<uint16_t, NODES> mDistance;
+    std::array<uint16_t, NODES> mParent;
+    std::array<Input, NODES> mVia;
+    std::array<uint16_t, NODES> mRest;
+    std::array<bool, NODES> mCanDrop;
+    std::array<bool, NODES> mClaimed;
+    std::array<uint16_t, NODES> mQueue;
+    std::array<Placement, MAX_PLACEMENTS> mPlacements;
+    int mCount = 0;
+    bool mTruncated = false;
+};
@@ -0,0 +1,267 @@
+#include "perfect_clear.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+namespace
+{
+
+// Whether the zone has an empty cell under the stack that a piece could not slide into from
+// an open cell beside it, on the same row.
+bool sealed(const Playfield& board, int lines)
+{
+    for (int r = Playfield::ROWS - lines; r != Playfield::ROWS; ++r)
+    {
+        uint32_t covered = 0;
+        for (int c = 0; c != Playfield::COLUMNS; ++c)
+            covered |= (board.height(c) > Playfield::ROWS - r ? 1u : 0u) << c;
+        uint32_t empty = ~static_cast<uint32_t>(board.row(r)) & Playfield::FULL_ROW;
+        uint32_t reached = empty & ~covered;
+        for (uint32_t last = 0; reached != last; )
+        {
+            last = reached;
+            reached |= (reached << 1 | reached >> 1) & empty;
+        }
+        if (empty & ~reached)
+            return true;
+    }
+    return false;
+}
+
+}
+
+PerfectClearSolver::PerfectClearSolver(WorkStealingPool& pool, size_t tableBytes) : mPool(pool), mTable(tableBytes)
+{
+    // One per worker and one for the root, made up front since each is about a hundred kilobytes.
+    for (int i = 0; i != pool.size() + 1; ++i)
+        mScratch.emplace_back(new Scratch);
+}
+
+PerfectClearSolver::Problem PerfectClearSolver::problemOf(const GameSnapshot& game, int maxLines)
+{
+    Problem problem;
+    const auto& pieces = game.pieces;
+    problem.playfield = game.playfield;
+    problem.queue[problem.queueSize++] = pieces.active.type;
+    for (const auto& next : pieces.next)
+        problem.queue[problem.queueSize++] = next.type;
+    problem.holding = pieces.holding;
+    problem.held = pieces.held.type;
+    problem.canHold = !pieces.hasHeld;
+    problem.maxLines = maxLines;
+    return problem;
+}
+
+bool PerfectClearSolver::solve(const Problem& problem, Solution& solution)
+{
+    mProblem = problem;
+    mProblem.queueSize = min(mProblem.queueSize, MAX_PIECES);
+    mFound = false;
+    mNodes = 0;
+    mTable.age();
+
+    if (mProblem.maxLines <= 0 || mProblem.maxLines > Playfield::ROWS || mProblem.queueSize == 0)
+        return false;
+    int height = 1;
+    for (int c = 0; c != Playfield::COLUMNS; ++c)
+        height = max(height, mProblem.playfield.height(c));
+
+    // The fewest rows first: a clear that needs less of the stack is no less a perfect clear.
+    const Pieces start { 0, mProblem.holding, mProblem.held };
+    for (int lines = height; lines <= mProblem.maxLines; ++lines)
+    {
+        if (feasible(mProblem.playfield, start, lines) && (run(lines, true) || run(lines, false)))
+        {
+            solution = mSolution;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PerfectClearSolver::run(int lines, bool strict)
+{
+    mStrict = strict;
+    mSalt = static_cast<uint64_t>(mProblem.queueSize) << 1 | (strict ? 1 : 0);
+    for (int i = 0; i != mProblem.queueSize; ++i)
+        mSalt = mSalt * TETROMINO_TYPES + static_cast<uint64_t>(mProblem.queue[i]);
+    mSalt = splitMix64(mSalt);
+
+    const auto& board = mProblem.playfield;
+    const Pieces start { 0, mProblem.holding, mProblem.held };
+    auto& root = *mScratch.back();
+    int count = expand(root, board, start, lines, 0);
+    mPool.run(static_cast<size_t>(count), [&] (size_t i, int worker) {
+        if (mFound.load(memory_order_relaxed))
+            return;
+        auto& scratch = *mScratch[worker];
+        const auto& step = root.candidates[0][i];
+        auto landed = board;
+        int cleared = landed.onLanding(step.piece.split(), step.piece.type);
+        scratch.solution.steps[0] = step;
+        if (cleared == lines)
+            found(scratch, 1);
+        else
+            search(scratch, landed, after(start, step), lines - cleared, 1);
+    });
+
+    for (auto& scratch : mScratch)
+    {
+        mNodes += scratch->nodes;
+        scratch->nodes = 0;
+    }
+    return mFound;
+}
+
+bool PerfectClearSolver::feasible(const Playfield& board, const Pieces& pieces, int lines) const
+{
+    array<int, TETROMINO_TYPES> counts {};
+    int available = 0;
+    for (int i = pieces.index; i < mProblem.queueSize; ++i, ++available)
+        ++counts[static_cast<int>(mProblem.queue[i])];
+    if (pieces.holding)
+    {
+        ++counts[static_cast<int>(pieces.held)];
+        ++available;
+    }
+
+    // Clears remove as many cells from even columns as from odd ones, and so do O, S and Z.
+    // J and L always tip the balance by two, T by two or none, I by four or none.
+    int total = 0;
+    int parity = 0;
+    int group = 0;
+    for (int c = 0; c != Playfield::COLUMNS; ++c)
+    {
+        int empty = lines - (board.height(c) - board.holes(c));
+        total += empty;
+        parity += c % 2 ? -empty : empty;
+
+        // Clears only ever bring cells of one column together, so a column with no empty
+        // cells walls off the columns either side for good.
+        if (empty != 0)
+            group += empty;
+        else if (group % 4 != 0)
+            return false;
+    }
+    if (group % 4 != 0 || total % 4 != 0 || total / 4 > available)
+        return false;
+
+    auto count = [&] (TetrominoType type) { return counts[static_cast<int>(type)]; };
+    int tilting = count(TetrominoType::J) + count(TetrominoType::L) + count(TetrominoType::T);
+    if (abs(parity) > 4 * count(TetrominoType::I) + 2 * tilting)
+        return false;
+    return tilting != 0 || parity % 4 == 0;
+}
+
+uint64_t PerfectClearSolver::keyOf(const Playfield& board, const Pieces& pieces, int lines) const
+{
+    uint64_t state = mSalt ^ (static_cast<uint64_t>(pieces.index) | static_cast<uint64_t>(lines) << 8
+        | static_cast<uint64_t>(pieces.holding ? 1 + static_cast<int>(pieces.held) : 0) << 16);
+    return board.hash() ^ splitMix64(state);
+}
+
+int PerfectClearSolver::addCandidates(
+    Scratch& scratch, const Playfield& board, TetrominoType type, bool hold, int lines, int ply, int count) const
+{
+    auto& candidates = scratch.candidates[ply];
+    const int top = Playfield::ROWS - lines;
+    // Nothing stands above the zone, and no kick lifts a piece by more than two rows, so one
+    // starting two rows over the zone reaches the same placements as one from the spawn.
+    auto start = TetrominoController::spawnOn(board, type);
+    start.bottom = static_cast<int16_t>(max<int>(start.bottom, top - 2));
+    scratch.generator.generate(board, start);
+    for (const auto& placement : scratch.generator)
+    {
+        auto cells = placement.piece.split();
+        if (!all_of(cells.begin(), cells.end(), [&] (const Cell& cell) { return cell.row >= top; }))
+            continue;
+        if (mStrict)
+        {
+            auto landed = board;
+            landed.onLanding(cells, type);
+            if (sealed(landed, lines))
+                continue;
+        }
+        candidates[count++] = { hold, placement.piece };
+    }
+    return count;
+}
+
+// Lowest placements first: they are the ones that complete rows.
+int PerfectClearSolver::expand(Scratch& scratch, const Playfield& board, const Pieces& pieces, int lines, int ply) const
+{
+    auto current = mProblem.queue[pieces.index];
+    int count = addCandidates(scratch, board, current, false, lines, ply, 0);
+    if (ply != 0 || mProblem.canHold)
+    {
+        if (pieces.holding && pieces.held != current)
+            count = addCandidates(scratch, board, pieces.held, true, lines, ply, count);
+        else if (!pieces.holding && pieces.index + 1 < mProblem.queueSize)
+            count = addCandidates(scratch, board, mProblem.queue[pieces.index + 1], true, lines, ply, count);
+    }
+
+    auto& candidates = scratch.candidates[ply];
+    stable_sort(candidates.begin(), candidates.begin() + count, [] (const Step& a, const Step& b) {
+        return a.piece.bottom > b.piece.bottom;
+    });
+    return count;
+}
+
+PerfectClearSolver::Pieces PerfectClearSolver::after(const Pieces& pieces, const Step& step) const
+{
+    Pieces next { pieces.index + 1, pieces.holding, pieces.held };
+    if (step.hold)
+    {
+        next.index += pieces.holding ? 0 : 1;
+        next.holding = true;
+        next.held = mProblem.queue[pieces.index];
+    }
+    return next;
+}
+
+bool PerfectClearSolver::search(Scratch& scratch, const Playfield& board, const Pieces& pieces, int lines, int ply)
+{
+    if (mFound.load(memory_order_relaxed) || pieces.index >= mProblem.queueSize)
+        return false;
+    ++scratch.nodes;
+    if (!feasible(board, pieces, lines))
+        return false;
+
+    auto key = keyOf(board, pieces, lines);
+    TranspositionTable::Entry entry;
+    if (mTable.probe(key, entry))
+        return false;
+
+    int count = expand(scratch, board, pieces, lines, ply);
+    for (int i = 0; i != count; ++i)
+    {
+        const auto& step = scratch.candidates[ply][i];
+        auto landed = board;
+        int cleared = landed.onLanding(step.piece.split(), step.piece.type);
+        scratch.solution.steps[ply] = step;
+        // Every filled cell was inside the zone, so clearing all of it empties the board.
+        if (cleared == lines)
+        {
+            found(scratch, ply + 1);
+            return true;
+        }
+        if (search(scratch, landed, after(pieces, step), lines - cleared, ply + 1))
+            return true;
+    }
+
+    if (!mFound.load(memory_order_relaxed))
+        mTable.store(key, { 0, 0, static_cast<uint8_t>(mProblem.queueSize - pieces.index) });
+    return false;
+}
+
+void PerfectClearSolver::found(const Scratch& scratch, int length)
+{
+    lock_guard<mutex> lock(mMutex);
+    if (mFound.load(memory_order_relaxed))
+        return;
+    mSolution = scratch.solution;
+    mSolution.length = length;
+    mFound.store(true, memory_order_relaxed);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "movegen.h"
+#include "tetris_core.h"
+#include "thread_pool.h"
+#include "transposition.h"
+
+// Finds a sequence of placements from the known pieces that leaves the board empty, using hold
+// as the game allows. A depth-first search over reachable placements inside the bottom rows,
+// split across the pool at the first piece; it tries as few rows as the stack allows first, then
+// one more at a time up to `maxLines`. Positions are pruned when:
+// - the empty cells in the zone are not a multiple of four or need more pieces than are left,
+// - column parity cannot be evened out by the I, J, L and T pieces left,
+// - a group of columns walled off by a full column holds a count of cells not divisible by four,
+// - the same stack, pieces and hold have already failed, per a table shared by all threads.
+// A first pass also skips placements that seal off an empty cell no sideways move can reach;
+// only when that finds nothing does a second pass search everything.
+class PerfectClearSolver final
+{
+public:
+    static constexpr int MAX_PIECES = 16;
+
+    struct Problem
+    {
+        Playfield playfield;
+        // queue[0] is the active piece; every piece spawns where the game would put it.
+        std::array<TetrominoType, MAX_PIECES> queue;
+        int queueSize = 0;
+        bool holding = false;
+        TetrominoType held = TetrominoType::I;
+        bool canHold = true;
+        int maxLines = 4;
+    };
+
+    struct Step
+    {
+        bool hold;
+        // Where the piece comes to rest; MoveGenerator::placementOf gives the inputs.
+        Tetromino piece;
+    };
+
+    struct Solution
+    {
+        std::array<Step, MAX_PIECES> steps;
+        int length = 0;
+    };
+
+    explicit PerfectClearSolver(WorkStealingPool&, size_t tableBytes = 16 << 20);
+
+    // The board, active piece, hold and next queue of a game.
+    static Problem problemOf(const GameSnapshot&, int maxLines = 4);
+
+    // With several threads, which of several solutions comes back depends on timing.
+    bool solve(const Problem&, Solution&);
+    uint64_t nodes() const { return mNodes; }
+
+private:
+    struct Pieces
+    {
+        int index;
+        bool holding;
+        TetrominoType held;
+    };
+
+    struct Scratch
+    {
+        MoveGenerator generator;
+        std::array<std::array<Step, 2 * MoveGenerator::MAX_PLACEMENTS>, MAX_PIECES> candidates;
+        Solution solution;
+        uint64_t nodes = 0;
+    };
+
+    bool run(int lines, bool strict);
+    bool feasible(const Playfield&, const Pieces&, int lines) const;
+    uint64_t keyOf(const Playfield&, const Pieces&, int lines) const;
+    int addCandidates(Scratch&, const Playfield&, TetrominoType, bool hold, int lines, int ply, int count) const;
+    int expand(Scratch&, const Playfield&, const Pieces&, int lines, int ply) const;
+    Pieces after(const Pieces&, const Step&) const;
+    bool search(Scratch&, const Playfield&, const Pieces&, int lines, int ply);
+    void found(const Scratch&, int length);
+
+    WorkStealingPool& mPool;
+    TranspositionTable mTable;
+    std::vector<std::unique_ptr<Scratch>> mScratch;
+
+    Problem mProblem;
+    // Mixed into every key, so entries left from another queue are misses rather than answers.
+    uint64_t mSalt = 0;
+    bool mStrict = false;
+    std::atomic<bool> mFound { false };
+    std::mutex mMutex;
+    Solution mSolution;
+    uint64_t mNodes = 0;
+};
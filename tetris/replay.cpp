@@ -0,0 +1,153 @@
+#include "replay.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <istream>
+#include <ostream>
+
+using namespace std;
+
+namespace
+{
+
+constexpr char MAGIC[4] = { 'T', 'T', 'R', 'P' };
+constexpr int INPUTS_COUNT = 6;
+constexpr int ACTIONS_COUNT = 3;
+
+void writeVarint(ostream& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.put(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.put(static_cast<char>(value));
+}
+
+bool readVarint(istream& in, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int byte = in.get();
+        if (byte == char_traits<char>::eof())
+            return false;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+}
+
+bool Replay::save(ostream& out) const
+{
+    out.write(MAGIC, sizeof(MAGIC));
+    out.put(static_cast<char>(VERSION));
+    for (int i = 0; i != 8; ++i)
+        out.put(static_cast<char>(seed >> (i * 8)));
+
+    writeVarint(out, handling.dasMicros);
+    writeVarint(out, handling.arrMicros);
+    writeVarint(out, handling.softDropMicros);
+    writeVarint(out, events.size());
+
+    uint64_t last = 0;
+    for (const auto& event : events)
+    {
+        writeVarint(out, event.micros - last);
+        out.put(static_cast<char>(static_cast<int>(event.input) * ACTIONS_COUNT + static_cast<int>(event.action)));
+        last = event.micros;
+    }
+    writeVarint(out, endMicros - last);
+    return static_cast<bool>(out);
+}
+
+bool Replay::load(istream& in)
+{
+    char magic[sizeof(MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || !equal(begin(magic), end(magic), MAGIC) || in.get() != VERSION)
+        return false;
+
+    seed = 0;
+    for (int i = 0; i != 8; ++i)
+    {
+        int byte = in.get();
+        if (byte == char_traits<char>::eof())
+            return false;
+        seed |= static_cast<uint64_t>(byte) << (i * 8);
+    }
+
+    uint64_t count;
+    if (!readVarint(in, handling.dasMicros) || !readVarint(in, handling.arrMicros)
+        || !readVarint(in, handling.softDropMicros) || !readVarint(in, count))
+        return false;
+
+    events.clear();
+    uint64_t micros = 0;
+    for (uint64_t i = 0; i != count; ++i)
+    {
+        uint64_t delta;
+        int code;
+        if (!readVarint(in, delta) || (code = in.get()) == char_traits<char>::eof()
+            || code >= INPUTS_COUNT * ACTIONS_COUNT)
+            return false;
+
+        micros += delta;
+        events.push_back({
+            micros, static_cast<Input>(code / ACTIONS_COUNT), static_cast<ReplayAction>(code % ACTIONS_COUNT) });
+    }
+
+    uint64_t tail;
+    if (!readVarint(in, tail))
+        return false;
+    endMicros = micros + tail;
+    return true;
+}
+
+bool Replay::save(const string& path) const
+{
+    ofstream out(path, ios::binary);
+    return out && save(out);
+}
+
+bool Replay::load(const string& path)
+{
+    ifstream in(path, ios::binary);
+    return in && load(in);
+}
+
+void ReplayPlayer::start(Simulation& simulation)
+{
+    simulation.setHandling(mReplay.handling);
+    simulation.reset(mReplay.seed);
+    mNext = 0;
+}
+
+void ReplayPlayer::advanceTo(Simulation& simulation, uint64_t micros)
+{
+    micros = min(micros, mReplay.endMicros);
+    for (; mNext != mReplay.events.size() && mReplay.events[mNext].micros <= micros; ++mNext)
+    {
+        const auto& event = mReplay.events[mNext];
+        if (event.micros > simulation.now())
+            simulation.advanceMicros(event.micros - simulation.now());
+
+        switch (event.action)
+        {
+        case ReplayAction::Press: simulation.press(event.input); break;
+        case ReplayAction::Release: simulation.release(event.input); break;
+        case ReplayAction::Apply: simulation.apply(event.input); break;
+        }
+    }
+
+    if (micros > simulation.now())
+        simulation.advanceMicros(micros - simulation.now());
+}
+
+bool ReplayPlayer::finished(const Simulation& simulation) const
+{
+    return simulation.gameOver() || simulation.now() >= mReplay.endMicros;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "tetris_core.h"
+
+// A recorded game: the bag seed, the handling it was played with and every input
+// with its simulation time. On disk, times are delta-encoded as LEB128 varints.
+struct Replay
+{
+    static constexpr uint8_t VERSION = 1;
+
+    uint64_t seed = 0;
+    Handling handling;
+    uint64_t endMicros = 0;
+    std::vector<ReplayEvent> events;
+
+    bool save(std::ostream&) const;
+    bool load(std::istream&);
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+};
+
+// Feeds a replay's inputs into a simulation at their recorded times.
+class ReplayPlayer final
+{
+public:
+    explicit ReplayPlayer(const Replay& replay) : mReplay(replay) { }
+
+    void start(Simulation&);
+    void advanceTo(Simulation&, uint64_t micros);
+    void runToEnd(Simulation& simulation) { advanceTo(simulation, mReplay.endMicros); }
+    bool finished(const Simulation& simulation) const;
+
+private:
+    const Replay& mReplay;
+    size_t mNext = 0;
+};
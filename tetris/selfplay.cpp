@@ -0,0 +1,125 @@
+#include "selfplay.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+GameResult playGame(const Weights& weights, uint64_t seed, int maxPieces)
+{
+    ManualClock clock;
+    GameContext context(clock, seed);
+    Bot bot(weights);
+
+    GameResult result { seed, 0, 0, 0, false };
+    while (result.pieces != maxPieces && !context.gameOver() && bot.play(context))
+        ++result.pieces;
+
+    result.lines = context.scoreBoard().lines();
+    result.scores = context.scoreBoard().scores();
+    result.over = result.pieces != maxPieces;
+    return result;
+}
+
+void playGames(WorkStealingPool& pool, const vector<Weights>& weights, const vector<uint64_t>& seeds,
+    int maxPieces, vector<GameResult>& results)
+{
+    results.resize(weights.size() * seeds.size());
+    pool.run(results.size(), [&] (size_t index, int) {
+        results[index] = playGame(weights[index / seeds.size()], seeds[index % seeds.size()], maxPieces);
+    });
+}
+
+GeneticTuner::GeneticTuner(WorkStealingPool& pool, const TuneSettings& settings, const Weights& start)
+    : mPool(pool), mSettings(settings), mRandom(settings.seed)
+{
+    mPopulation.push_back(normalized(start));
+    while (static_cast<int>(mPopulation.size()) < mSettings.population)
+    {
+        auto weights = start;
+        for (auto& value : weights.values)
+            value += gaussian() * mSettings.mutation;
+        mPopulation.push_back(normalized(weights));
+    }
+}
+
+Candidate GeneticTuner::step()
+{
+    // Every candidate plays the same pieces, so luck of the bag does not decide the ranking.
+    mSeeds.clear();
+    for (int i = 0; i != mSettings.games; ++i)
+        mSeeds.push_back(static_cast<uint64_t>(mRandom.next()) << 32 | mRandom.next());
+
+    playGames(mPool, mPopulation, mSeeds, mSettings.maxPieces, mResults);
+    mGamesPlayed += mResults.size();
+
+    mRanked.clear();
+    for (size_t i = 0; i != mPopulation.size(); ++i)
+    {
+        Candidate candidate { mPopulation[i], 0, 0, 0 };
+        for (size_t game = 0; game != mSeeds.size(); ++game)
+        {
+            const auto& result = mResults[i * mSeeds.size() + game];
+            candidate.lines += result.lines;
+            candidate.scores += result.scores;
+        }
+        candidate.lines /= mSeeds.size();
+        candidate.scores /= mSeeds.size();
+        candidate.fitness = candidate.scores + candidate.lines * mSettings.lineValue;
+        mRanked.push_back(candidate);
+    }
+    stable_sort(mRanked.begin(), mRanked.end(), [] (const Candidate& a, const Candidate& b) {
+        return a.fitness > b.fitness;
+    });
+
+    mPopulation.clear();
+    for (int i = 0; i != min(mSettings.elites, static_cast<int>(mRanked.size())); ++i)
+        mPopulation.push_back(mRanked[i].weights);
+    while (static_cast<int>(mPopulation.size()) < mSettings.population)
+    {
+        const auto& a = tournament().weights;
+        const auto& b = tournament().weights;
+        Weights child;
+        for (int i = 0; i != FEATURES_COUNT; ++i)
+        {
+            float blend = mRandom.next() / 4294967296.0f;
+            child.values[i] = a.values[i] + (b.values[i] - a.values[i]) * blend + gaussian() * mSettings.mutation;
+        }
+        mPopulation.push_back(normalized(child));
+    }
+
+    ++mGeneration;
+    return mRanked.front();
+}
+
+// Box-Muller; one of the pair is thrown away.
+float GeneticTuner::gaussian()
+{
+    double u1 = (mRandom.next() + 1.0) / 4294967297.0;
+    double u2 = mRandom.next() / 4294967296.0;
+    return static_cast<float>(sqrt(-2 * log(u1)) * cos(2 * M_PI * u2));
+}
+
+// The best of three drawn at random; the ranking is sorted, so that is the lowest index.
+const Candidate& GeneticTuner::tournament()
+{
+    auto size = static_cast<uint32_t>(mRanked.size());
+    auto best = mRandom.below(size);
+    for (int i = 0; i != 2; ++i)
+        best = min(best, mRandom.below(size));
+    return mRanked[best];
+}
+
+Weights GeneticTuner::normalized(Weights weights)
+{
+    float length = 0;
+    for (auto value : weights.values)
+        length += value * value;
+    length = sqrt(length);
+    if (length > 0)
+    {
+        for (auto& value : weights.values)
+            value /= length;
+    }
+    return weights;
+}
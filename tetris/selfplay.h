@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "bot.h"
+#include "thread_pool.h"
+
+struct GameResult
+{
+    uint64_t seed;
+    int pieces;
+    int lines;
+    int scores;
+    bool over;
+};
+
+// Plays one seeded game with a bot under the real rules until it tops out or has placed
+// maxPieces. The clock stands still, so only the placements matter, not how fast they come.
+GameResult playGame(const Weights&, uint64_t seed, int maxPieces);
+
+// Plays every (weights, seed) pair across the pool; results are indexed weights-major.
+void playGames(WorkStealingPool&, const std::vector<Weights>&, const std::vector<uint64_t>& seeds,
+    int maxPieces, std::vector<GameResult>& results);
+
+struct TuneSettings
+{
+    int population = 32;
+    int elites = 4;
+    int games = 8;
+    int maxPieces = 500;
+    // Standard deviation of the noise added to each weight of a child.
+    float mutation = 0.2f;
+    // Fitness is the mean score plus this much per mean cleared line.
+    float lineValue = 100;
+    uint64_t seed = 1;
+};
+
+struct Candidate
+{
+    Weights weights;
+    double fitness;
+    double lines;
+    double scores;
+};
+
+// A generational genetic algorithm over evaluation weights. Each generation plays every
+// candidate on the same fresh seeds, keeps the elites and breeds the rest by tournament
+// selection, blend crossover and Gaussian mutation. Weights are kept at unit length, since
+// a bot only compares scores and scaling them changes nothing.
+class GeneticTuner final
+{
+public:
+    GeneticTuner(WorkStealingPool&, const TuneSettings&, const Weights& start = Weights::defaults());
+
+    // Plays and ranks the current population, then breeds the next; returns this generation's best.
+    Candidate step();
+    int generation() const { return mGeneration; }
+    uint64_t gamesPlayed() const { return mGamesPlayed; }
+
+private:
+    float gaussian();
+    const Candidate& tournament();
+    static Weights normalized(Weights);
+
+    WorkStealingPool& mPool;
+    TuneSettings mSettings;
+    Random mRandom;
+    std::vector<Weights> mPopulation;
+    std::vector<Candidate> mRanked;
+    std::vector<uint64_t> mSeeds;
+    std::vector<GameResult> mResults;
+    int mGeneration = 0;
+    uint64_t mGamesPlayed = 0;
+};
@@ -1,34 +1,52 @@
 #include <array>
-#include <list>
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <memory>
+#include <new>
 #include <string>
 #include <sstream>
 #include <exception>
-#include <random>
+#include <stdexcept>
 #include <algorithm>
+#include <random>
+#include <cstdio>
 #include <cstdlib>
-#include <ctime>
 #include <SDL2/SDL.h>
 
+#include "tetris_core.h"
+#include "autoplay.h"
+#include "replay.h"
+#include "concurrent.h"
+#include "trace.h"
+
 using namespace std;
 
 #define BACKGROUND_COLOR 0x21, 0x21, 0x21, 0xFF
-constexpr int FPS = 60;
-const int MILLISECONDS_PER_FRAME = round(1000. / FPS);
+constexpr int DEFAULT_FPS = 60;
+constexpr uint64_t MICROS_PER_SECOND = 1000000;
+constexpr uint64_t SPIN_MICROS = 2000;
+constexpr uint64_t SIMULATION_STEP_MICROS = 1000;
+constexpr size_t INPUT_QUEUE_CAPACITY = 64;
+constexpr uint64_t MAX_CATCH_UP_MICROS = 250000;
+constexpr size_t RECORDING_RESERVED_EVENTS = 1 << 16;
+constexpr int IDLE_WAIT_MILLIS = 1000;
 constexpr int CELL_LEN = 40;
-constexpr int CELL_COLUMNS = 10;
-constexpr int CELL_ROWS = 22;
-constexpr int VISABLE_ROWS = 20;
-constexpr int HIDDEN_ROWS = CELL_ROWS - VISABLE_ROWS;
 constexpr int CELL_MARGIN = 6;
 constexpr int CELL_DRAWN_LEN = CELL_LEN - CELL_MARGIN * 2;
-constexpr int NEXT_PIECES_COUNT = 3;
 constexpr SDL_Rect HOLD_BOARD { 0, 0, 6*CELL_LEN, 4*CELL_LEN };
-constexpr SDL_Rect PLAYFIELD { HOLD_BOARD.x + HOLD_BOARD.w + CELL_LEN, 0, CELL_COLUMNS * CELL_LEN, VISABLE_ROWS * CELL_LEN };
+constexpr SDL_Rect PLAYFIELD { HOLD_BOARD.x + HOLD_BOARD.w + CELL_LEN, 0, Playfield::COLUMNS * CELL_LEN, VISABLE_ROWS * CELL_LEN };
 constexpr SDL_Rect NEXT_BOARD { PLAYFIELD.x + PLAYFIELD.w + CELL_LEN, 0, 6*CELL_LEN, (3*NEXT_PIECES_COUNT + 1) * CELL_LEN, };
 constexpr int SCREEN_WIDTH = HOLD_BOARD.w + CELL_LEN + PLAYFIELD.w + CELL_LEN + NEXT_BOARD.w;
 constexpr int SCREEN_HEIGHT = VISABLE_ROWS * CELL_LEN;
+constexpr int GLYPH_WIDTH = 5;
+constexpr int GLYPH_HEIGHT = 7;
+constexpr int HUD_MAX_GLYPHS = 64;
+constexpr int FRAME_STATS_WINDOW = 240;
+constexpr int FRAME_STATS_BUCKETS = 40;
+constexpr uint64_t FRAME_STATS_BUCKET_MICROS = 1000;
+constexpr size_t LATENCY_SAMPLES_PER_ACTION = 1 << 13;
 
 struct SDLError : public exception
 {
@@ -64,214 +82,101 @@ static type& instance() \
     return type_Singleton; \
 } \
 
-using RendererPtr = unique_ptr<SDL_Renderer, void(*)(SDL_Renderer*)>;
-using WindowPtr = unique_ptr<SDL_Window, void(*)(SDL_Window*)>;
-using SurfacePtr = unique_ptr<SDL_Surface, void(*)(SDL_Surface*)>;
-using TexturePtr = unique_ptr<SDL_Texture, void(*)(SDL_Texture*)>;
+#ifdef TETRIS_COUNT_ALLOCATIONS
 
-struct Object { virtual ~Object() { } };
-struct Cell { int column; int row; };
-using Cells = array<Cell, 4>;
-
-class ITetromino : public Object
-{
-public:
-    static constexpr Uint32 LOCK_DELAY_MILLISECONDS = 500;
-    static constexpr int STATES_COUNT = 4;
-
-    enum State { Up, Right, Down, Left };
-    using Shape = Uint16;
-    using Shapes = array<Shape, STATES_COUNT>;
-    struct HardDropResult { int cleard; int dropped; };
-
-    virtual SDL_Color color() const = 0;
-    virtual int heightOf(State) const = 0;
-    virtual int widthOf(State) const = 0;
-    virtual Shape shapeOf(State) const = 0;
-    virtual void tryRotate() = 0;
-
-    void init();
-    void spawn();
-    void moveLeft();
-    void moveRight();
-    int softDrop(int rows = 1);
-    HardDropResult hardDrop();
-
-    void draw(int x, int y, State state) const;
-    void draw() const { draw(PLAYFIELD.x + mLeft * CELL_LEN, PLAYFIELD.y + mBottom * CELL_LEN, mState); }
-
-    Cells split(int left, int bottom, State state) const;
-    Cells split(int left, int bottom) const { return split(left, bottom, mState); }
-    Cells split() const { return split(mLeft, mBottom, mState); }
-
-    int width() const { return widthOf(mState); }
-    int height() const { return heightOf(mState); }
-    bool visiable() const { return mBottom > HIDDEN_ROWS; }
-    bool locking() const { return mLocking; }
-    Uint32 lockTicks() const { return mLockTicks; }
-
-protected:
-    void tryRotate(const vector<Cell>& offsets, const vector<vector<Cell>>& attempts);
-    void lock(Uint32 ticksNow);
-    void unlock(Uint32 ticksNow);
-
-private:
-    int mLeft = 0;
-    int mBottom = 0;
-    State mState = State::Up;
-    Uint32 mLockTicks = 0;
-    bool mLocking = false;
-};
-
-struct ITetromino3x3 : public ITetromino
-{
-    int heightOf(State state) const override { return "\2\3\2\3"[state]; }
-    int widthOf(State state) const override { return "\3\2\3\2"[state]; }
-    void tryRotate() override;
-};
-
-struct I_Tetromino final : public ITetromino
-{
-    SDL_Color color() const override { return { 0x00, 0xE6, 0xE6, 0xAA }; }
-    int heightOf(State state) const override { return "\1\4\1\4"[state]; }
-    int widthOf(State state) const override { return "\4\1\4\1"[state]; }
-    Shape shapeOf(State state) const override { return Shapes{ 0x000F, 0x8888, 0x000F, 0x8888 }[state]; }
-    void tryRotate() override;
-};
-
-struct O_Tetromino final : public ITetromino
-{
-    SDL_Color color() const override { return { 0xE6, 0xE6, 0x00, 0xAA }; }
-    int widthOf(State) const override { return 2; }
-    int heightOf(State) const override { return 2; }
-    Shape shapeOf(State) const override { return 0x00CC; }
-    void tryRotate() override { }
-};
-
-struct T_Tetromino final : public ITetromino3x3
-{
-    SDL_Color color() const override { return { 0xE6, 0x00, 0xE6, 0xAA }; }
-    Shape shapeOf(State state) const override { return Shapes{ 0x004E, 0x08C8, 0x00E4, 0x04C4 }[state]; }
-};
+// Debug builds count every operator new; after the first frame the loop must not allocate.
+static atomic<uint64_t> gAllocations { 0 };
 
-struct J_Tetromino final : public ITetromino3x3
+void* operator new(size_t size)
 {
-    SDL_Color color() const override { return { 0x00, 0x72, 0xFB, 0xAA }; }
-    Shape shapeOf(State state) const override { return Shapes{ 0x008E, 0x0C88, 0x00E2, 0x044C }[state]; }
-};
-
-struct L_Tetromino final : public ITetromino3x3
-{
-    SDL_Color color() const override { return { 0xE6, 0x95, 0x00, 0xAA }; }
-    Shape shapeOf(State state) const override { return Shapes{ 0x002E, 0x088C, 0x00E8, 0x0C44 }[state]; }
-};
-
-struct S_Tetromino final : public ITetromino3x3
-{
-    SDL_Color color() const override { return { 0x00, 0xE6, 0x00, 0xAA }; }
-    Shape shapeOf(State state) const override { return Shapes{ 0x006C, 0x08C4, 0x006C, 0x08C4 }[state]; }
-};
+    ++gAllocations;
+    if (auto p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
 
-struct Z_Tetromino final : public ITetromino3x3
-{
-    SDL_Color color() const override { return { 0xE6, 0x00, 0x00, 0xAA }; }
-    Shape shapeOf(State state) const override { return Shapes{ 0x00C6, 0x04C8, 0x00C6, 0x04C8 }[state]; }
-};
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
 
-class TetrominoController
+class AllocationCheck final
 {
 public:
-    DEFINE_SINGLETON(TetrominoController)
+    DEFINE_SINGLETON(AllocationCheck)
 
-    void reset();
-    void onKeyDown(const SDL_Event&);
-    void update();
+    void endFrame()
+    {
+        if (mStarted && gAllocations != mAllocations)
+        {
+            SDL_Log("%llu heap allocation(s) during a frame",
+                static_cast<unsigned long long>(gAllocations - mAllocations));
+            abort();
+        }
+        mStarted = true;
+        mAllocations = gAllocations;
+    }
 
-    void draw() const;
+    // For the rare deliberate allocation, such as writing a replay to disk.
+    void forgive() { mAllocations = gAllocations; }
 
 private:
-    TetrominoController();
-
-    shared_ptr<ITetromino> make();
-    shared_ptr<ITetromino> next();
-    void hold();
-    void land();
-
-    shared_ptr<ITetromino> mActive;
-    shared_ptr<ITetromino> mHeld;
-    list<shared_ptr<ITetromino>> mNextPieces;
-    array<function<shared_ptr<ITetromino> ()>, 7> mTetrominoCreators;
-    size_t mIndex = 7;
-    Uint32 mUpdateTicks = 0;
-    bool mHasHeld = false;
+    AllocationCheck() = default;
+
+    bool mStarted = false;
+    uint64_t mAllocations = 0;
 };
 
-class Playfield final
+#else
+
+class AllocationCheck final
 {
 public:
-    struct Block { SDL_Color color; bool filled; };
-    using Row = array<Block, CELL_COLUMNS>;
-
-    DEFINE_SINGLETON(Playfield)
+    DEFINE_SINGLETON(AllocationCheck)
 
-    void reset();
-    int onLanding(const Cells&, SDL_Color);
-    void draw() const;
-    Cells getLandingSpot(const Cells&) const;
-    bool isFilled(const Cells&) const;
+    void endFrame() { }
+    void forgive() { }
 
 private:
-    Playfield() { reset(); }
-    bool isFilled(int column, int row) const;
-
-    vector<Row> mPlayfield;
+    AllocationCheck() = default;
 };
 
-class ScoreBoard final
-{
-public:
-    DEFINE_SINGLETON(ScoreBoard)
-
-    void reset();
-    void onClear(int rows);
-    void onSoftDrop(int rows);
-    void onHardDrop(int rows);
-    void updateTitle();
+#endif
 
-    string title() const;
-    int speed() const { return mTicksPerRow; }
-
-private:
-    ScoreBoard() { reset(); }
-    void tryLevelUp();
-
-    int mTicksPerRow;
-    int mCurrLevel;
-    int mCurrCleardRows;
-    int mTotalCleardRows;
-    int mScores;
-};
+using RendererPtr = unique_ptr<SDL_Renderer, void(*)(SDL_Renderer*)>;
+using WindowPtr = unique_ptr<SDL_Window, void(*)(SDL_Window*)>;
+using SurfacePtr = unique_ptr<SDL_Surface, void(*)(SDL_Surface*)>;
+using TexturePtr = unique_ptr<SDL_Texture, void(*)(SDL_Texture*)>;
 
 class Timer final
 {
 public:
+    enum class Pacing { Sleep, Hybrid, VSync, };
+
     DEFINE_SINGLETON(Timer)
 
-    void tick(Uint32 cappingTicks);
+    void configure(Pacing pacing, int fps);
+    void tick(bool presented);
     void pause();
     void resume();
 
-    Uint32 frameTicks() const { return mFrameTicks; }
-    Uint32 getTicks() const { return (mHasPaused ?  mPauseStart : SDL_GetTicks()) - mPausedTicks; }
+    Pacing pacing() const { return mPacing; }
+    int fps() const { return mFps; }
+    uint64_t frameMicros() const { return mFrameMicros; }
+    uint64_t getMicros() const { return (mHasPaused ? mPauseStart : now()) - mPausedMicros; }
 
 private:
-    Timer() { mMark = mLastTicks = SDL_GetTicks(); }
-
-    Uint32 mMark;
-    Uint32 mLastTicks;
-    Uint32 mFrameTicks = 0;
-    Uint32 mPauseStart = 0;
-    Uint32 mPausedTicks = 0;
+    Timer();
+    uint64_t now() const;
+    void waitUntil(uint64_t deadline) const;
+
+    Pacing mPacing = Pacing::Hybrid;
+    int mFps = 0;
+    uint64_t mFrequency;
+    uint64_t mFramePeriod = MICROS_PER_SECOND / DEFAULT_FPS;
+    uint64_t mDeadline;
+    uint64_t mLastMicros;
+    uint64_t mFrameMicros = 0;
+    uint64_t mPauseStart = 0;
+    uint64_t mPausedMicros = 0;
     bool mHasPaused = false;
 };
 
@@ -282,7 +187,9 @@ struct GameState : public Object
     virtual ID id() const = 0;
     virtual void handleEvent(const SDL_Event&) = 0;
     virtual void update() { }
-    virtual void draw() { }
+    virtual void draw(const FrameSnapshot&) { }
+    // Idle states only change on input, so the loop blocks on the event queue.
+    virtual bool idle() const { return true; }
     virtual void onEnter() { };
     virtual void onExit(ID) { };
 };
@@ -290,10 +197,15 @@ struct GameState : public Object
 struct PlayState final : public GameState
 {
     ID id() const override { return ID::Playing; }
+    bool idle() const override { return false; }
     void handleEvent(const SDL_Event&) override;
     void update() override;
-    void draw() override;
+    void draw(const FrameSnapshot&) override;
     void onEnter() override;
+    void onExit(ID nextStateID) override;
+
+private:
+    void afterStep();
 };
 
 struct PauseState final : public GameState
@@ -307,9 +219,11 @@ struct PauseState final : public GameState
 struct GameOver final : public GameState
 {
     ID id() const override { return ID::GameOver; }
+    bool idle() const override;
 
     void handleEvent(const SDL_Event&) override;
-    void draw() override;
+    void update() override;
+    void draw(const FrameSnapshot&) override;
     void onEnter() override;
     void onExit(ID nextStateID) override;
 };
@@ -327,19 +241,27 @@ class GameStateManager final
 public:
     DEFINE_SINGLETON(GameStateManager)
 
-    void changeState(const shared_ptr<GameState>&);
+    void changeState(GameState::ID);
     void goBack();
-    void handleEvents();
+    void handleEvents(bool wait);
     void update() { mCurrState->update(); }
-    void draw() { mCurrState->draw(); }
+    void draw(const FrameSnapshot& frame) { mCurrState->draw(frame); }
+    bool idle() const { return mCurrState->idle(); }
 
     GameState::ID lastStateID() const { return mLastState ? mLastState->id() : GameState::ID::None; }
 
 private:
     GameStateManager() = default;
-
-    shared_ptr<GameState> mLastState;
-    shared_ptr<GameState> mCurrState;
+    GameState* stateOf(GameState::ID);
+    void handleEvent(const SDL_Event&);
+
+    // Every state lives here for the whole run, so switching never allocates.
+    PlayState mPlaying;
+    PauseState mPaused;
+    GameOver mGameOver;
+    BeforeExit mBeforeExit;
+    GameState* mLastState = nullptr;
+    GameState* mCurrState = nullptr;
 };
 
 class Game final
@@ -347,521 +269,677 @@ class Game final
 public:
     DEFINE_SINGLETON(Game)
 
-    void draw();
+    // sequence numbers key-downs in arrival order for latency measurement; 0 for key-ups.
+    struct TimedInput { uint64_t micros; Input input; bool pressed; uint32_t sequence; };
+    // A snapshot plus the newest key-down the simulation had applied when it was taken.
+    struct Frame { FrameSnapshot snapshot; uint32_t inputSequence; };
+
+    // Redraws and presents only if something visible changed; returns whether it did.
+    bool draw();
+    void invalidate() { mInvalid = true; }
     void reset();
+    void queueInput(const SDL_Event&, Input);
+    void releaseInputs();
+    void advance();
+    bool gameOver();
+    // With a simulation thread, the game advances on its own while playing and
+    // this thread only renders the newest snapshot it has published.
+    void setThreaded(bool threaded) { mThreaded = threaded; }
+    bool threaded() const { return mThreaded; }
+    void startSimulation();
+    void stopSimulation();
+    void setHandling(const Handling& handling) { mSimulation.setHandling(handling); }
+    void record(const string& path);
+    void saveRecording();
+    void trace(const string& path);
+    void writeTrace();
+    void replay(const string& path);
+    bool replaying() const { return static_cast<bool>(mPlayer); }
+    // The bot plays instead of the keyboard, restarting after every game over.
+    void autoplay(const AutoPlayer::Settings& settings) { mBot.reset(new AutoPlayer(settings)); }
+    bool autoplaying() const { return static_cast<bool>(mBot); }
     SDL_Renderer* renderer() { return mRenderer.get(); }
     SDL_Window* window() { return mWindow.get(); }
+    GameContext& context() { return mSimulation.context(); }
 
 private:
     Game();
 
+    void apply(const TimedInput&);
+    void applyBotInput();
+    void insertInput(TimedInput);
+    void runSimulation();
+    void publish();
+    const Frame& frame();
+    bool changed(const Frame&) const;
+
+    Simulation mSimulation;
+    uint64_t mOrigin = 0;
+    vector<TimedInput> mInputs;
+    bool mThreaded = false;
+    thread mSimulationThread;
+    atomic<bool> mRunning { false };
+    SpscQueue<TimedInput, INPUT_QUEUE_CAPACITY> mInbox;
+    TripleBuffer<Frame> mFrames;
+    Frame mFrame;
+    uint32_t mKeyDowns = 0;
+    uint32_t mAppliedSequence = 0;
+    bool mInvalid = true;
+    Frame mDrawn;
+    Replay mRecording;
+    string mRecordingPath;
+    string mTracePath;
+    Replay mPlayback;
+    unique_ptr<ReplayPlayer> mPlayer;
+    unique_ptr<AutoPlayer> mBot;
     WindowPtr mWindow { nullptr, SDL_DestroyWindow };
     RendererPtr mRenderer { nullptr, SDL_DestroyRenderer };
     TexturePtr mBackground { nullptr, SDL_DestroyTexture };
 };
 
-inline void fillCell(int x, int y, SDL_Color color)
+// Collects every cell of a frame and submits them in one SDL_RenderGeometry call.
+class CellBatch final
 {
-    REQUIRES_ZERO(SDL_SetRenderDrawColor(
-        Game::instance().renderer(), color.r, color.g, color.b, color.a));
+public:
+    DEFINE_SINGLETON(CellBatch)
 
-    SDL_Rect rect {
-        x + CELL_MARGIN,
-        y + CELL_MARGIN - HIDDEN_ROWS * CELL_LEN,
-        CELL_DRAWN_LEN, CELL_DRAWN_LEN
-    };
+    void fill(int x, int y, SDL_Color color);
+    void outline(int x, int y, SDL_Color color);
+    void flush();
 
-    REQUIRES_ZERO(SDL_RenderFillRect(Game::instance().renderer(), &rect));
+private:
+    CellBatch();
+    void addQuad(int x, int y, int w, int h, SDL_Color color);
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    vector<SDL_Vertex> mVertices;
+    vector<int> mIndices;
+#endif
+};
+
+inline void fillCell(int x, int y, SDL_Color color)
+{
+    CellBatch::instance().fill(x + CELL_MARGIN, y + CELL_MARGIN - HIDDEN_ROWS * CELL_LEN, color);
 }
 
 inline void drawCell(int x, int y, SDL_Color color)
 {
-    REQUIRES_ZERO(SDL_SetRenderDrawColor(
-        Game::instance().renderer(), color.r, color.g, color.b, color.a));
+    CellBatch::instance().outline(x + CELL_MARGIN, y + CELL_MARGIN - HIDDEN_ROWS * CELL_LEN, color);
+}
 
-    SDL_Rect rect {
-        x + CELL_MARGIN,
-        y + CELL_MARGIN - HIDDEN_ROWS * CELL_LEN,
-        CELL_DRAWN_LEN, CELL_DRAWN_LEN };
+constexpr SDL_Color TETROMINO_COLORS[TETROMINO_TYPES] = {
+    { 0x00, 0xE6, 0xE6, 0xAA }, { 0xE6, 0xE6, 0x00, 0xAA }, { 0xE6, 0x00, 0xE6, 0xAA },
+    { 0x00, 0x72, 0xFB, 0xAA }, { 0xE6, 0x95, 0x00, 0xAA }, { 0x00, 0xE6, 0x00, 0xAA },
+    { 0xE6, 0x00, 0x00, 0xAA },
+};
+constexpr SDL_Color LOCKING_COLOR { 0x55, 0x55, 0x55, 0xFF };
 
-    REQUIRES_ZERO(SDL_RenderDrawRect(Game::instance().renderer(), &rect));
+inline SDL_Color colorOf(TetrominoType type)
+{
+    return TETROMINO_COLORS[static_cast<int>(type)];
 }
 
-void ITetromino::init()
+void drawTetromino(const Tetromino& tetromino, int x, int y, Tetromino::State state, bool locking = false)
 {
-    mState = State::Up;
-    mLocking = false;
-    mLockTicks = 0;
-    mLeft = (CELL_COLUMNS - width()) / 2;
-    mBottom = height();
+    auto color = locking ? LOCKING_COLOR : colorOf(tetromino.type);
+    for (const auto cell : tetromino.split(0, 0, state))
+    {
+        fillCell(x + cell.column * CELL_LEN, y + cell.row * CELL_LEN, color);
+    }
 }
 
-void ITetromino::spawn()
+// The settled stack, kept in a render target and re-rasterized only for rows that changed.
+class PlayfieldTexture final
 {
-    init();
+public:
+    DEFINE_SINGLETON(PlayfieldTexture)
 
-    for (int bottom = HIDDEN_ROWS + mBottom; bottom >= mBottom; --bottom)
-    {
-        if (!Playfield::instance().isFilled(split(mLeft, bottom)))
-        {
-            mBottom = bottom;
-            break;
-        }
-    }
+    void draw(const Playfield&);
+    void invalidate() { mInvalid = true; }
 
-    if (Playfield::instance().isFilled(split(mLeft, mBottom + 1)))
-    {
-        lock(Timer::instance().getTicks());
-    }
-}
+private:
+    PlayfieldTexture() = default;
+    void update(const Playfield&, Playfield::RowMask dirtyRows);
 
-void ITetromino::moveLeft()
+    TexturePtr mTexture { nullptr, SDL_DestroyTexture };
+    Playfield mShown;
+    bool mInvalid = true;
+};
+
+// Score, level and lines drawn from a 5x7 bitmap font baked into one texture.
+// The glyph quads are only laid out again when the score board's revision moves.
+class Hud final
 {
-    if (!Playfield::instance().isFilled(split(mLeft - 1, mBottom)))
-    {
-        --mLeft;
-        unlock(Timer::instance().getTicks());
-    }
-}
+public:
+    DEFINE_SINGLETON(Hud)
+
+    void draw(const ScoreBoard&);
+    // Draws straight away, for text that changes every frame.
+    void drawText(int x, int y, int scale, const char* text);
+    void invalidate() { mAtlas.reset(); }
+
+private:
+    struct Glyph { SDL_Rect source; SDL_Rect target; };
+
+    Hud() = default;
+    void bake();
+    void layout(const ScoreBoard&);
+    int addText(int x, int y, int scale, const char* text);
+
+    TexturePtr mAtlas { nullptr, SDL_DestroyTexture };
+    array<Glyph, HUD_MAX_GLYPHS> mGlyphs;
+    int mGlyphCount = 0;
+    uint32_t mRevision = 0;
+    bool mLaidOut = false;
+};
 
-void ITetromino::moveRight()
+// --latency mode: time from each key-down's SDL timestamp until SDL_RenderPresent returns
+// for the first frame that reflects it, bucketed by action.
+class InputLatency final
 {
-    if (!Playfield::instance().isFilled(split(mLeft + 1, mBottom)))
-    {
-        ++mLeft;
-        unlock(Timer::instance().getTicks());
-    }
-}
+public:
+    enum Action { Move, Rotate, Hold, HardDrop, SoftDrop, ACTIONS_COUNT, };
+
+    DEFINE_SINGLETON(InputLatency)
+
+    void enable(const string& path);
+    bool enabled() const { return !mPath.empty(); }
+    void onKeyDown(uint32_t sequence, Input, uint64_t eventMicros);
+    void onPresent(uint32_t inputSequence, uint64_t presentMicros);
+    void clearPending() { mPending.clear(); }
+    void write();
 
-int ITetromino::softDrop(int rows)
+private:
+    struct Pending { uint32_t sequence; Action action; uint64_t micros; };
+
+    InputLatency() = default;
+
+    string mPath;
+    RingBuffer<Pending, INPUT_QUEUE_CAPACITY> mPending;
+    array<vector<uint32_t>, ACTIONS_COUNT> mSamples;
+};
+
+// Rolling frame times behind the F3 overlay: p50/p99 and a 1 ms bucket histogram.
+class FrameStats final
 {
-    if (locking())
-        return 0;
+public:
+    DEFINE_SINGLETON(FrameStats)
 
-    int height = [this] {
-        auto cells = split();
-        auto landingSpot = Playfield::instance().getLandingSpot(cells);
-        return landingSpot.at(0).row - cells.at(0).row;
-    }();
+    void add(uint64_t frameMicros);
+    void draw();
+    void toggle() { mVisible = !mVisible; }
+    bool visible() const { return mVisible; }
 
-    if (height <= rows)
-    {
-        mBottom += height;
-        lock(Timer::instance().getTicks());
-        return height;
-    }
+private:
+    FrameStats() = default;
+    uint64_t percentile(int percent) const;
 
-    mBottom += rows;
-    return rows;
-}
+    RingBuffer<uint32_t, FRAME_STATS_WINDOW> mFrames;
+    array<int, FRAME_STATS_BUCKETS> mBuckets {};
+    bool mVisible = false;
+};
 
-ITetromino::HardDropResult ITetromino::hardDrop()
+void drawPlayfield(const Playfield& playfield)
 {
-    HardDropResult r;
-    r.dropped = softDrop(CELL_ROWS);
-    r.cleard = Playfield::instance().onLanding(split(), color());
-    return r;
+    PlayfieldTexture::instance().draw(playfield);
 }
 
-Cells ITetromino::split(int left, int bottom, State state) const
+void drawHud(const ScoreBoard& scoreBoard)
 {
-    Cells cells;
-    auto shape = shapeOf(state);
-    for (int i = 0, j = 0; i != 16; ++i)
-    {
-        if (shape & (0x8000 >> i))
-        {
-            cells[j].column = left + i % STATES_COUNT;
-            cells[j++].row = bottom - STATES_COUNT + i / STATES_COUNT;
-        }
-    }
-    return cells;
+    Hud::instance().draw(scoreBoard);
 }
 
-void ITetromino::draw(int x, int y, State state) const
+void drawTetrominoes(const FrameSnapshot& frame)
 {
-    auto color_ = locking() ? SDL_Color{ 0x55, 0x55, 0x55, 0xFF } : color();
-    for (const auto cell : split(0, 0, state))
+    TRACE_SCOPE("TetrominoController::draw");
+    const auto& active = frame.active;
+    if (active.visiable())
     {
-        fillCell(x + cell.column * CELL_LEN, y + cell.row * CELL_LEN, color_);
+        for (const auto cell : frame.ghost)
+            drawCell(
+                PLAYFIELD.x + cell.column*CELL_LEN,
+                PLAYFIELD.y + cell.row*CELL_LEN,
+                colorOf(active.type));
     }
-}
+    drawTetromino(
+        active, PLAYFIELD.x + active.left * CELL_LEN, PLAYFIELD.y + active.bottom * CELL_LEN, active.state,
+        frame.locking);
 
-void ITetromino::tryRotate(const vector<Cell>& offsets, const vector<vector<Cell>>& attempts)
-{
-    auto nextState = static_cast<State>((mState + 1) % STATES_COUNT);
-    auto leftBase = mLeft + offsets.at(nextState).column;
-    auto bottomBase = mBottom + offsets.at(nextState).row;
+    int i = 0;
+    for (auto type : frame.next)
+    {
+        auto n = Tetromino::of(type);
+        drawTetromino(
+            n,
+            NEXT_BOARD.x + (NEXT_BOARD.w - n.widthOf(Tetromino::State::Up) * CELL_LEN) / 2,
+            NEXT_BOARD.y + 3*CELL_LEN * (i+1) + HIDDEN_ROWS * CELL_LEN,
+            Tetromino::State::Up);
+        ++i;
+    }
 
-    for (const auto attempt : attempts.at(nextState))
+    if (frame.holding)
     {
-        auto left = leftBase + attempt.column;
-        auto bottom = bottomBase + attempt.row;
-        if (!Playfield::instance().isFilled(split(left, bottom, nextState)))
-        {
-            mLeft = left;
-            mBottom = bottom;
-            mState = nextState;
-            unlock(Timer::instance().getTicks());
-            return;
-        }
+        auto held = Tetromino::of(frame.held);
+        drawTetromino(
+            held,
+            HOLD_BOARD.x + (HOLD_BOARD.w - held.widthOf(Tetromino::State::Up) * CELL_LEN) / 2,
+            HOLD_BOARD.y + 3*CELL_LEN + HIDDEN_ROWS * CELL_LEN,
+            Tetromino::State::Up);
     }
 }
 
-void ITetromino::lock(Uint32 ticksNow)
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+
+CellBatch::CellBatch()
 {
-    mLocking = true;
-    mLockTicks = ticksNow;
+    constexpr int MAX_QUADS = Playfield::ROWS * Playfield::COLUMNS + 4 * (5 + NEXT_PIECES_COUNT) * 4;
+    mVertices.reserve(MAX_QUADS * 4);
+    mIndices.reserve(MAX_QUADS * 6);
 }
 
-void ITetromino::unlock(Uint32 ticksNow)
+void CellBatch::fill(int x, int y, SDL_Color color)
 {
-    if (!Playfield::instance().isFilled(split(mLeft, mBottom + 1)))
-    {
-        mLocking = false;
-    }
-    mLockTicks = ticksNow;
+    addQuad(x, y, CELL_DRAWN_LEN, CELL_DRAWN_LEN, color);
 }
 
-void ITetromino3x3::tryRotate()
+void CellBatch::outline(int x, int y, SDL_Color color)
 {
-    static const vector<Cell> offsets { {0, -1}, {1, 1}, {-1, 0}, {0, 0} };
-    static const vector<vector<Cell>> attempts {
-        { {0, 0}, {-1, 0}, {-1,-1}, {0, 2}, {-1, 2}, },
-        { {0, 0}, {-1, 0}, {-1, 1}, {0,-2}, {-1,-2}, },
-        { {0, 0}, {1, 0}, {1,-1}, {0, 2}, {1, 2}, },
-        { {0, 0}, {1, 0}, {1, 1}, {0,-2}, {1,-2}, },
-    };
-    ITetromino::tryRotate(offsets, attempts);
+    addQuad(x, y, CELL_DRAWN_LEN, 1, color);
+    addQuad(x, y + CELL_DRAWN_LEN - 1, CELL_DRAWN_LEN, 1, color);
+    addQuad(x, y + 1, 1, CELL_DRAWN_LEN - 2, color);
+    addQuad(x + CELL_DRAWN_LEN - 1, y + 1, 1, CELL_DRAWN_LEN - 2, color);
 }
 
-void I_Tetromino::tryRotate()
+void CellBatch::flush()
 {
-    static const vector<Cell> offsets { {-1, -2}, {2, 2}, {-2, -1}, {1, 1}, };
-    static const vector<vector<Cell>> attempts {
-        { {0, 0}, {1, 0}, {-2, 0}, {1,-2}, {-2, 1}, },
-        { {0, 0}, {-2, 0}, {1, 0}, {-2,-1}, {1, 2}, },
-        { {0, 0}, {-1, 0}, {2, 0}, {-1, 2}, {2,-1}, },
-        { {0, 0}, {2, 0}, {-1, 0}, {2, 1}, {-1,-2}, },
-    };
-    ITetromino::tryRotate(offsets, attempts);
+    if (!mIndices.empty())
+    {
+        REQUIRES_ZERO(SDL_RenderGeometry(
+            Game::instance().renderer(), nullptr,
+            mVertices.data(), static_cast<int>(mVertices.size()),
+            mIndices.data(), static_cast<int>(mIndices.size())));
+    }
+    mVertices.clear();
+    mIndices.clear();
 }
 
-TetrominoController::TetrominoController()
+void CellBatch::addQuad(int x, int y, int w, int h, SDL_Color color)
 {
-    srand(time(nullptr));
-
-    mTetrominoCreators = {
-        [] { return make_shared<I_Tetromino>(); }, [] { return make_shared<O_Tetromino>(); },
-        [] { return make_shared<T_Tetromino>(); }, [] { return make_shared<J_Tetromino>(); },
-        [] { return make_shared<L_Tetromino>(); }, [] { return make_shared<S_Tetromino>(); },
-        [] { return make_shared<Z_Tetromino>(); },
-    };
-
-    reset();
+    int base = static_cast<int>(mVertices.size());
+    float left = x, top = y, right = x + w, bottom = y + h;
+    mVertices.push_back({ { left, top }, color, { 0, 0 } });
+    mVertices.push_back({ { right, top }, color, { 0, 0 } });
+    mVertices.push_back({ { right, bottom }, color, { 0, 0 } });
+    mVertices.push_back({ { left, bottom }, color, { 0, 0 } });
+    for (int i : { 0, 1, 2, 0, 2, 3 })
+        mIndices.push_back(base + i);
 }
 
-void TetrominoController::reset()
-{
-    mIndex = mTetrominoCreators.size();
+#else
 
-    mActive = make();
-    mActive->spawn();
-    mHeld.reset();
+CellBatch::CellBatch() = default;
 
-    mNextPieces.clear();
-    for (int i = 0; i != NEXT_PIECES_COUNT; ++i)
-        mNextPieces.emplace_back(make());
+void CellBatch::fill(int x, int y, SDL_Color color)
+{
+    addQuad(x, y, CELL_DRAWN_LEN, CELL_DRAWN_LEN, color);
+}
 
-    mUpdateTicks = 0;
-    mHasHeld = false;
+void CellBatch::outline(int x, int y, SDL_Color color)
+{
+    REQUIRES_ZERO(SDL_SetRenderDrawColor(
+        Game::instance().renderer(), color.r, color.g, color.b, color.a));
+    SDL_Rect rect { x, y, CELL_DRAWN_LEN, CELL_DRAWN_LEN };
+    REQUIRES_ZERO(SDL_RenderDrawRect(Game::instance().renderer(), &rect));
 }
 
-void TetrominoController::onKeyDown(const SDL_Event& e)
+void CellBatch::flush() { }
+
+void CellBatch::addQuad(int x, int y, int w, int h, SDL_Color color)
 {
-    switch (e.key.keysym.sym)
-    {
-    case SDLK_UP: if (!e.key.repeat) mActive->tryRotate(); break;
-    case SDLK_c: if (!e.key.repeat) hold(); break;
-    case SDLK_DOWN: ScoreBoard::instance().onSoftDrop(mActive->softDrop()); break;
-    case SDLK_LEFT: mActive->moveLeft(); break;
-    case SDLK_RIGHT: mActive->moveRight(); break;
-    case SDLK_SPACE: land(); break;
-    default: break;
-    }
+    REQUIRES_ZERO(SDL_SetRenderDrawColor(
+        Game::instance().renderer(), color.r, color.g, color.b, color.a));
+    SDL_Rect rect { x, y, w, h };
+    REQUIRES_ZERO(SDL_RenderFillRect(Game::instance().renderer(), &rect));
 }
 
-void TetrominoController::update()
+#endif
+
+void PlayfieldTexture::draw(const Playfield& playfield)
 {
-    if (mActive->locking())
+    TRACE_SCOPE("Playfield::draw");
+    auto renderer = Game::instance().renderer();
+    if (!mTexture)
     {
-        auto lockingTicks = Timer::instance().getTicks() - mActive->lockTicks();
-        if (lockingTicks >= ITetromino::LOCK_DELAY_MILLISECONDS)
-        {
-            land();
-            mUpdateTicks = 0;
-            return;
-        }
+        mTexture.reset(SDL_CreateTexture(
+            renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, PLAYFIELD.w, PLAYFIELD.h));
+        REQUIRES_NOT_NULL(mTexture);
+        REQUIRES_ZERO(SDL_SetTextureBlendMode(mTexture.get(), SDL_BLENDMODE_BLEND));
+        mInvalid = true;
     }
 
-    mUpdateTicks += Timer::instance().frameTicks();
-    auto rows = mUpdateTicks / ScoreBoard::instance().speed();
-    if (rows > 0)
-    {
-        mUpdateTicks %= ScoreBoard::instance().speed();
-        mActive->softDrop(rows);
-    }
+    auto dirtyRows = mInvalid ? Playfield::ALL_ROWS : playfield.diffRows(mShown);
+    mInvalid = false;
+    mShown = playfield;
+    if (dirtyRows >> HIDDEN_ROWS)
+        update(playfield, dirtyRows >> HIDDEN_ROWS << HIDDEN_ROWS);
+
+    REQUIRES_ZERO(SDL_RenderCopy(renderer, mTexture.get(), nullptr, &PLAYFIELD));
 }
 
-void TetrominoController::draw() const
+void PlayfieldTexture::update(const Playfield& playfield, Playfield::RowMask dirtyRows)
 {
-    if (mActive->visiable())
-    {
-        for (const auto cell : Playfield::instance().getLandingSpot(mActive->split()))
-            drawCell(
-                PLAYFIELD.x + cell.column*CELL_LEN,
-                PLAYFIELD.y + cell.row*CELL_LEN,
-                mActive->color());
-    }
-    mActive->draw();
+    auto renderer = Game::instance().renderer();
+    CellBatch::instance().flush();
+    REQUIRES_ZERO(SDL_SetRenderTarget(renderer, mTexture.get()));
+    REQUIRES_ZERO(SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE));
+    REQUIRES_ZERO(SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0));
 
-    int i = 0;
-    for (const auto& n: mNextPieces)
+    for (auto rows = dirtyRows; rows != 0; rows &= rows - 1)
     {
-        n->draw(
-            NEXT_BOARD.x + (NEXT_BOARD.w - n->widthOf(ITetromino::State::Up) * CELL_LEN) / 2,
-            NEXT_BOARD.y + 3*CELL_LEN * (i+1) + HIDDEN_ROWS * CELL_LEN,
-            ITetromino::State::Up);
-        ++i;
-    }
+        int r = __builtin_ctzll(rows);
+        SDL_Rect strip { 0, (r - HIDDEN_ROWS) * CELL_LEN, PLAYFIELD.w, CELL_LEN };
+        REQUIRES_ZERO(SDL_RenderFillRect(renderer, &strip));
 
-    if (mHeld)
-    {
-        mHeld->draw(
-            HOLD_BOARD.x + (HOLD_BOARD.w - mHeld->widthOf(ITetromino::State::Up) * CELL_LEN) / 2,
-            HOLD_BOARD.y + 3*CELL_LEN + HIDDEN_ROWS * CELL_LEN,
-            ITetromino::State::Up);
+        for (uint64_t bits = playfield.row(r); bits != 0; bits &= bits - 1)
+        {
+            int c = __builtin_ctzll(bits);
+            CellBatch::instance().fill(
+                c*CELL_LEN + CELL_MARGIN, (r - HIDDEN_ROWS)*CELL_LEN + CELL_MARGIN,
+                colorOf(playfield.typeAt(c, r)));
+        }
     }
+
+    CellBatch::instance().flush();
+    REQUIRES_ZERO(SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND));
+    REQUIRES_ZERO(SDL_SetRenderTarget(renderer, nullptr));
 }
 
-shared_ptr<ITetromino> TetrominoController::make()
+struct GlyphBitmap { char ch; uint8_t rows[GLYPH_HEIGHT]; };
+
+// Bit 4 is the leftmost column; only the characters the HUD prints are baked.
+constexpr GlyphBitmap FONT[] = {
+    { '.', { 0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b01100, 0b01100 } },
+    { '0', { 0b01110, 0b10001, 0b10011, 0b10101, 0b11001, 0b10001, 0b01110 } },
+    { '1', { 0b00100, 0b01100, 0b00100, 0b00100, 0b00100, 0b00100, 0b01110 } },
+    { '2', { 0b01110, 0b10001, 0b00001, 0b00010, 0b00100, 0b01000, 0b11111 } },
+    { '3', { 0b11111, 0b00010, 0b00100, 0b00010, 0b00001, 0b10001, 0b01110 } },
+    { '4', { 0b00010, 0b00110, 0b01010, 0b10010, 0b11111, 0b00010, 0b00010 } },
+    { '5', { 0b11111, 0b10000, 0b11110, 0b00001, 0b00001, 0b10001, 0b01110 } },
+    { '6', { 0b00110, 0b01000, 0b10000, 0b11110, 0b10001, 0b10001, 0b01110 } },
+    { '7', { 0b11111, 0b00001, 0b00010, 0b00100, 0b01000, 0b01000, 0b01000 } },
+    { '8', { 0b01110, 0b10001, 0b10001, 0b01110, 0b10001, 0b10001, 0b01110 } },
+    { '9', { 0b01110, 0b10001, 0b10001, 0b01111, 0b00001, 0b00010, 0b01100 } },
+    { 'C', { 0b01110, 0b10001, 0b10000, 0b10000, 0b10000, 0b10001, 0b01110 } },
+    { 'E', { 0b11111, 0b10000, 0b10000, 0b11110, 0b10000, 0b10000, 0b11111 } },
+    { 'I', { 0b01110, 0b00100, 0b00100, 0b00100, 0b00100, 0b00100, 0b01110 } },
+    { 'L', { 0b10000, 0b10000, 0b10000, 0b10000, 0b10000, 0b10000, 0b11111 } },
+    { 'M', { 0b10001, 0b11011, 0b10101, 0b10101, 0b10001, 0b10001, 0b10001 } },
+    { 'N', { 0b10001, 0b10001, 0b11001, 0b10101, 0b10011, 0b10001, 0b10001 } },
+    { 'O', { 0b01110, 0b10001, 0b10001, 0b10001, 0b10001, 0b10001, 0b01110 } },
+    { 'P', { 0b11110, 0b10001, 0b10001, 0b11110, 0b10000, 0b10000, 0b10000 } },
+    { 'R', { 0b11110, 0b10001, 0b10001, 0b11110, 0b10100, 0b10010, 0b10001 } },
+    { 'S', { 0b01111, 0b10000, 0b10000, 0b01110, 0b00001, 0b00001, 0b11110 } },
+    { 'V', { 0b10001, 0b10001, 0b10001, 0b10001, 0b10001, 0b01010, 0b00100 } },
+};
+constexpr int FONT_SIZE = sizeof(FONT) / sizeof(FONT[0]);
+
+int glyphIndex(char ch)
 {
-    if (mIndex >= mTetrominoCreators.size())
+    for (int i = 0; i != FONT_SIZE; ++i)
     {
-        random_shuffle(mTetrominoCreators.begin(), mTetrominoCreators.end());
-        mIndex = 0;
+        if (FONT[i].ch == ch)
+            return i;
     }
-    return mTetrominoCreators[mIndex++]();
+    return -1;
 }
 
-shared_ptr<ITetromino> TetrominoController::next()
+void Hud::draw(const ScoreBoard& scoreBoard)
 {
-    auto next = mNextPieces.front();
-    next->spawn();
-    mNextPieces.pop_front();
-    mNextPieces.push_back(make());
-    mHasHeld = false;
-    return next;
-}
+    if (!mAtlas)
+        bake();
+    if (!mLaidOut || mRevision != scoreBoard.revision())
+        layout(scoreBoard);
 
-void TetrominoController::hold()
-{
-    if (!mHasHeld)
-    {
-        mActive.swap(mHeld);
-        if (!mActive)
-            mActive = next();
-        mActive->spawn();
-        mHeld->init();
-        mHasHeld = true;
-    }
+    for (int i = 0; i != mGlyphCount; ++i)
+        REQUIRES_ZERO(SDL_RenderCopy(Game::instance().renderer(), mAtlas.get(), &mGlyphs[i].source, &mGlyphs[i].target));
 }
 
-void TetrominoController::land()
+void Hud::drawText(int x, int y, int scale, const char* text)
 {
-    auto r = mActive->hardDrop();
-    if (!mActive->visiable())
-    {
-        GameStateManager::instance().changeState(make_shared<GameOver>());
-        return;
-    }
+    if (!mAtlas)
+        bake();
 
-    ScoreBoard::instance().onClear(r.cleard);
-    ScoreBoard::instance().onHardDrop(r.dropped);
-
-    mActive = next();
-    if (Playfield::instance().isFilled(mActive->split()))
+    for (; *text; ++text, x += (GLYPH_WIDTH + 1) * scale)
     {
-        GameStateManager::instance().changeState(make_shared<GameOver>());
+        int index = glyphIndex(*text);
+        if (index < 0)
+            continue;
+
+        SDL_Rect source { index * GLYPH_WIDTH, 0, GLYPH_WIDTH, GLYPH_HEIGHT };
+        SDL_Rect target { x, y, GLYPH_WIDTH * scale, GLYPH_HEIGHT * scale };
+        REQUIRES_ZERO(SDL_RenderCopy(Game::instance().renderer(), mAtlas.get(), &source, &target));
     }
 }
 
-void Playfield::reset()
+void Hud::bake()
 {
-    mPlayfield.resize(CELL_ROWS);
+    SurfacePtr surface(
+        SDL_CreateRGBSurfaceWithFormat(0, FONT_SIZE * GLYPH_WIDTH, GLYPH_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888),
+        SDL_FreeSurface);
+    REQUIRES_NOT_NULL(surface);
 
-    for (auto& row : mPlayfield)
+    for (int y = 0; y != GLYPH_HEIGHT; ++y)
     {
-        for (auto& block : row)
+        auto pixels = reinterpret_cast<Uint32*>(static_cast<Uint8*>(surface->pixels) + y * surface->pitch);
+        for (int i = 0; i != FONT_SIZE; ++i)
         {
-            block.filled = false;
+            for (int x = 0; x != GLYPH_WIDTH; ++x)
+                pixels[i*GLYPH_WIDTH + x] = FONT[i].rows[y] >> (GLYPH_WIDTH - 1 - x) & 1 ? 0xFFFFFFFF : 0;
         }
     }
+
+    mAtlas.reset(SDL_CreateTextureFromSurface(Game::instance().renderer(), surface.get()));
+    REQUIRES_NOT_NULL(mAtlas);
+    REQUIRES_ZERO(SDL_SetTextureBlendMode(mAtlas.get(), SDL_BLENDMODE_BLEND));
 }
 
-int Playfield::onLanding(const Cells& cells, SDL_Color color)
+void Hud::layout(const ScoreBoard& scoreBoard)
 {
-    for (const auto cell: cells)
-    {
-        mPlayfield.at(cell.row).at(cell.column).filled = true;
-        mPlayfield[cell.row][cell.column].color = color;
-    }
+    const pair<const char*, int> lines[] = {
+        { "SCORE", scoreBoard.scores() },
+        { "LEVEL", scoreBoard.level() },
+        { "LINES", scoreBoard.lines() },
+    };
 
-    int cleared = 0;
-    for (auto row = mPlayfield.begin(); row != mPlayfield.end();)
+    mGlyphCount = 0;
+    int x = HOLD_BOARD.x + CELL_LEN / 2;
+    int y = HOLD_BOARD.y + HOLD_BOARD.h + CELL_LEN;
+    for (const auto& line : lines)
     {
-        if (all_of(row->cbegin(), row->cend(), [] (const auto& block) { return block.filled; }))
-        {
-            ++cleared;
-            row = mPlayfield.erase(row);
-            continue;
-        }
-        ++row;
+        char value[16];
+        snprintf(value, sizeof(value), "%d", line.second);
+        y = addText(x, y, 3, line.first) + CELL_LEN / 4;
+        y = addText(x, y, 4, value) + CELL_LEN;
     }
 
-    for (int i = 0; i != cleared; ++i)
-        mPlayfield.emplace(mPlayfield.begin(), Row());
-
-    return cleared;
+    mRevision = scoreBoard.revision();
+    mLaidOut = true;
 }
 
-Cells Playfield::getLandingSpot(const Cells& cells) const
+// Returns the bottom edge of the text.
+int Hud::addText(int x, int y, int scale, const char* text)
 {
-    for (auto landingSpot = cells;;)
+    for (; *text && mGlyphCount != HUD_MAX_GLYPHS; ++text, x += (GLYPH_WIDTH + 1) * scale)
     {
-        for (const auto cell : landingSpot)
-        {
-            if (isFilled(cell.column, cell.row + 1))
-                return landingSpot;
-        }
+        int index = glyphIndex(*text);
+        if (index < 0)
+            continue;
 
-        for (auto& cell : landingSpot)
-            ++cell.row;
+        mGlyphs[mGlyphCount++] = {
+            { index * GLYPH_WIDTH, 0, GLYPH_WIDTH, GLYPH_HEIGHT },
+            { x, y, GLYPH_WIDTH * scale, GLYPH_HEIGHT * scale },
+        };
     }
+    return y + GLYPH_HEIGHT * scale;
 }
 
-bool Playfield::isFilled(const Cells& cells) const
+void InputLatency::enable(const string& path)
 {
-    return any_of(
-        cells.cbegin(), cells.cend(),
-        [this] (Cell cell) { return isFilled(cell.column, cell.row); });
+    mPath = path;
+    for (auto& samples : mSamples)
+        samples.reserve(LATENCY_SAMPLES_PER_ACTION);
 }
 
-void Playfield::draw() const
+void InputLatency::onKeyDown(uint32_t sequence, Input input, uint64_t eventMicros)
 {
-    for (size_t r = 0; r != mPlayfield.size(); ++r)
+    Action action;
+    switch (input)
     {
-        for (size_t c = 0; c != mPlayfield[r].size(); ++c)
-        {
-            if (mPlayfield[r][c].filled)
-                fillCell(
-                    PLAYFIELD.x + c*CELL_LEN, PLAYFIELD.y + r*CELL_LEN,
-                    mPlayfield[r][c].color);
-        }
+    case Input::MoveLeft: case Input::MoveRight: action = Move; break;
+    case Input::Rotate: action = Rotate; break;
+    case Input::Hold: action = Hold; break;
+    case Input::HardDrop: action = HardDrop; break;
+    case Input::SoftDrop: action = SoftDrop; break;
+    default: return;
     }
+    mPending.push_back({ sequence, action, eventMicros });
 }
 
-bool Playfield::isFilled(int column, int row) const
-{
-    return row < 0 || row >= CELL_ROWS
-        || column < 0 || column >= CELL_COLUMNS
-        || mPlayfield[row][column].filled;
-}
-
-
-void ScoreBoard::reset()
-{
-    mTicksPerRow = 1000;
-    mCurrLevel = 1;
-    mCurrCleardRows = 0;
-    mTotalCleardRows = 0;
-    mScores = 0;
-}
-
-void ScoreBoard::onClear(int rows)
+void InputLatency::onPresent(uint32_t inputSequence, uint64_t presentMicros)
 {
-    if (rows > 0)
+    for (; !mPending.empty() && mPending.front().sequence <= inputSequence; mPending.pop_front())
     {
-        mScores += array<int, 4>{ 100, 300, 500, 800 }.at(rows - 1) * mCurrLevel;
-        mTotalCleardRows += rows;
-        mCurrCleardRows += rows;
-        tryLevelUp();
-        updateTitle();
+        const auto& pending = mPending.front();
+        auto& samples = mSamples[pending.action];
+        if (samples.size() != LATENCY_SAMPLES_PER_ACTION)
+            samples.push_back(static_cast<uint32_t>(presentMicros > pending.micros ? presentMicros - pending.micros : 0));
     }
 }
 
-void ScoreBoard::onSoftDrop(int rows)
+void InputLatency::write()
 {
-    if (rows > 0)
+    static const char* ACTION_NAMES[ACTIONS_COUNT] = { "move", "rotate", "hold", "hard_drop", "soft_drop", };
+    static const char* PACING_NAMES[] = { "sleep", "hybrid", "vsync", };
+
+    if (!enabled())
+        return;
+    auto file = fopen(mPath.c_str(), "w");
+    if (!file)
     {
-        mScores += min(rows, 20);
-        updateTitle();
+        SDL_Log("%s: failed to write latency samples", mPath.c_str());
+        return;
     }
-}
 
-void ScoreBoard::onHardDrop(int rows)
-{
-    if (rows > 0)
+    SDL_RendererInfo info;
+    auto renderer = SDL_GetRendererInfo(Game::instance().renderer(), &info) == 0 ? info.name : "unknown";
+    fprintf(file, "{\n  \"renderer\": \"%s\", \"pacing\": \"%s\", \"fps\": %d, \"sim_thread\": %s,\n  \"actions\": {",
+        renderer, PACING_NAMES[static_cast<int>(Timer::instance().pacing())], Timer::instance().fps(),
+        Game::instance().threaded() ? "true" : "false");
+
+    for (int action = 0; action != ACTIONS_COUNT; ++action)
     {
-        mScores += min(rows * 2, 40);
-        updateTitle();
+        auto sorted = mSamples[action];
+        sort(sorted.begin(), sorted.end());
+        auto at = [&] (int percent) { return sorted.empty() ? 0 : sorted[(sorted.size() - 1) * percent / 100]; };
+
+        fprintf(file, "%s\n    \"%s\": { \"count\": %zu, \"p50_us\": %u, \"p90_us\": %u, \"p99_us\": %u, \"max_us\": %u, \"samples_us\": [",
+            action ? "," : "", ACTION_NAMES[action], sorted.size(), at(50), at(90), at(99), at(100));
+        for (size_t i = 0; i != mSamples[action].size(); ++i)
+            fprintf(file, "%s%u", i ? ", " : "", mSamples[action][i]);
+        fprintf(file, "] }");
+
+        if (!sorted.empty())
+            SDL_Log("%-9s n=%-5zu p50=%.1fms p99=%.1fms", ACTION_NAMES[action], sorted.size(), at(50) / 1000., at(99) / 1000.);
     }
+    fprintf(file, "\n  }\n}\n");
+    fclose(file);
 }
 
-string ScoreBoard::title() const
+void FrameStats::add(uint64_t frameMicros)
 {
-    ostringstream ss;
-    ss << "Level: " << mCurrLevel << " "
-       << "Lines: " << mTotalCleardRows << " "
-       << "Scores: " << mScores;
-    return ss.str();
+    auto bucketOf = [] (uint64_t micros) {
+        return static_cast<int>(min<uint64_t>(micros / FRAME_STATS_BUCKET_MICROS, FRAME_STATS_BUCKETS - 1));
+    };
+    if (mFrames.full())
+        --mBuckets[bucketOf(mFrames.front())];
+    mFrames.push_back(static_cast<uint32_t>(min<uint64_t>(frameMicros, UINT32_MAX)));
+    ++mBuckets[bucketOf(frameMicros)];
 }
 
-void ScoreBoard::updateTitle()
+uint64_t FrameStats::percentile(int percent) const
 {
-    SDL_SetWindowTitle(Game::instance().window(), title().c_str());
+    if (mFrames.empty())
+        return 0;
+
+    array<uint32_t, FRAME_STATS_WINDOW> sorted;
+    for (size_t i = 0; i != mFrames.size(); ++i)
+        sorted[i] = mFrames[i];
+    auto last = sorted.begin() + mFrames.size();
+    auto nth = sorted.begin() + (mFrames.size() - 1) * percent / 100;
+    nth_element(sorted.begin(), nth, last);
+    return *nth;
 }
 
-void ScoreBoard::tryLevelUp()
+void FrameStats::draw()
 {
-    static array<Uint32, 15> speeds {
-        1000, 793, 618, 473, 355,
-        262, 190, 135, 94, 64,
-        43, 28, 18, 11, 7
-    };
+    TRACE_SCOPE("FrameStats::draw");
+    constexpr int BAR_WIDTH = HOLD_BOARD.w / FRAME_STATS_BUCKETS;
+    constexpr int HEIGHT = 2 * CELL_LEN;
+    const int bottom = SCREEN_HEIGHT - CELL_LEN / 2;
 
-    if (mCurrLevel >= 15)
-        return;
+    auto renderer = Game::instance().renderer();
+    int most = *max_element(mBuckets.begin(), mBuckets.end());
+    array<SDL_Rect, FRAME_STATS_BUCKETS> bars;
+    for (int i = 0; i != FRAME_STATS_BUCKETS; ++i)
+    {
+        int height = most ? mBuckets[i] * HEIGHT / most : 0;
+        bars[i] = { HOLD_BOARD.x + i * BAR_WIDTH, bottom - height, BAR_WIDTH - 1, height };
+    }
+    REQUIRES_ZERO(SDL_SetRenderDrawColor(renderer, 0x9E, 0x9E, 0x9E, 0xFF));
+    REQUIRES_ZERO(SDL_RenderFillRects(renderer, bars.data(), FRAME_STATS_BUCKETS));
 
-    int requiredRows = mCurrLevel * 5;
-    if (mCurrCleardRows < requiredRows)
-        return;
+    char text[32];
+    for (auto percent : { 50, 99 })
+    {
+        auto micros = percentile(percent);
+        snprintf(text, sizeof(text), "P%d %llu.%llu MS", percent,
+            static_cast<unsigned long long>(micros / 1000), static_cast<unsigned long long>(micros % 1000 / 100));
+        Hud::instance().drawText(HOLD_BOARD.x + CELL_LEN / 4, bottom - HEIGHT - (percent == 50 ? 2 : 1) * 3 * CELL_LEN / 4, 2, text);
+    }
+}
+
+Timer::Timer() : mFrequency(SDL_GetPerformanceFrequency())
+{
+    mDeadline = mLastMicros = now();
+}
 
-    mTicksPerRow = speeds.at(mCurrLevel);
-    mCurrCleardRows -= requiredRows;
-    ++mCurrLevel;
+void Timer::configure(Pacing pacing, int fps)
+{
+    mPacing = pacing;
+    mFps = fps;
+    if (fps > 0)
+        mFramePeriod = MICROS_PER_SECOND / fps;
 }
 
-void Timer::tick(Uint32 cappingTicks)
+void Timer::tick(bool presented)
 {
-    Uint32 interval = SDL_GetTicks() - mMark;
-    if (interval < cappingTicks)
-        SDL_Delay(cappingTicks - interval);
+    if (mPacing == Pacing::VSync && presented)
+    {
+        mDeadline = now();
+    }
+    else
+    {
+        mDeadline += mFramePeriod;
+        auto current = now();
+        if (current > mDeadline + mFramePeriod)
+            mDeadline = current;
+        else
+            waitUntil(mDeadline);
+    }
 
-    Uint32 currTicks = getTicks();
-    mFrameTicks = currTicks - mLastTicks;
-    mLastTicks = currTicks;
-    mMark = SDL_GetTicks();
+    auto currMicros = getMicros();
+    mFrameMicros = currMicros - mLastMicros;
+    mLastMicros = currMicros;
 }
 
 void Timer::pause()
@@ -869,7 +947,7 @@ void Timer::pause()
     if (!mHasPaused)
     {
         mHasPaused = true;
-        mPauseStart = SDL_GetTicks();
+        mPauseStart = now();
     }
 }
 
@@ -878,45 +956,94 @@ void Timer::resume()
     if (mHasPaused)
     {
         mHasPaused = false;
-        mPausedTicks += SDL_GetTicks() - mPauseStart;
+        mPausedMicros += now() - mPauseStart;
+    }
+}
+
+uint64_t Timer::now() const
+{
+    auto counter = SDL_GetPerformanceCounter();
+    return counter / mFrequency * MICROS_PER_SECOND + counter % mFrequency * MICROS_PER_SECOND / mFrequency;
+}
+
+void Timer::waitUntil(uint64_t deadline) const
+{
+    TRACE_SCOPE("Timer::sleep");
+    for (auto current = now(); current < deadline; current = now())
+    {
+        auto remaining = deadline - current;
+        if (mPacing == Pacing::Sleep)
+            SDL_Delay(static_cast<Uint32>((remaining + 999) / 1000));
+        else if (remaining > SPIN_MICROS)
+            SDL_Delay(static_cast<Uint32>((remaining - SPIN_MICROS) / 1000));
     }
 }
 
 void PlayState::handleEvent(const SDL_Event& e)
 {
-    if (e.type != SDL_KEYDOWN)
+    if ((e.type != SDL_KEYDOWN && e.type != SDL_KEYUP) || e.key.repeat)
         return;
 
-    if (e.key.keysym.sym == SDLK_ESCAPE)
+    if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE)
     {
-        GameStateManager::instance().changeState(make_shared<PauseState>());
+        GameStateManager::instance().changeState(GameState::ID::Paused);
         return;
     }
 
-    TetrominoController::instance().onKeyDown(e);
+    Input input;
+    switch (e.key.keysym.sym)
+    {
+    case SDLK_UP: input = Input::Rotate; break;
+    case SDLK_c: input = Input::Hold; break;
+    case SDLK_DOWN: input = Input::SoftDrop; break;
+    case SDLK_LEFT: input = Input::MoveLeft; break;
+    case SDLK_RIGHT: input = Input::MoveRight; break;
+    case SDLK_SPACE: input = Input::HardDrop; break;
+    default: return;
+    }
+
+    if (!Game::instance().replaying() && !Game::instance().autoplaying())
+        Game::instance().queueInput(e, input);
 }
 
 void PlayState::update()
 {
-    TetrominoController::instance().update();
+    TRACE_SCOPE("PlayState::update");
+    if (!Game::instance().threaded())
+        Game::instance().advance();
+    afterStep();
 }
 
-void PlayState::draw()
+void PlayState::draw(const FrameSnapshot& frame)
 {
-    Playfield::instance().draw();
-    TetrominoController::instance().draw();
+    drawPlayfield(frame.playfield);
+    drawTetrominoes(frame);
+    drawHud(frame.scoreBoard);
 }
 
 void PlayState::onEnter()
 {
-    ScoreBoard::instance().updateTitle();
+    SDL_SetWindowTitle(Game::instance().window(), "Tetris");
+    Game::instance().startSimulation();
+}
+
+void PlayState::onExit(ID)
+{
+    Game::instance().stopSimulation();
+    Game::instance().releaseInputs();
+}
+
+void PlayState::afterStep()
+{
+    if (Game::instance().gameOver())
+        GameStateManager::instance().changeState(GameState::ID::GameOver);
 }
 
 void PauseState::handleEvent(const SDL_Event& e)
 {
     if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_RETURN)
     {
-        GameStateManager::instance().changeState(make_unique<PlayState>());
+        GameStateManager::instance().changeState(GameState::ID::Playing);
     }
 }
 
@@ -941,23 +1068,37 @@ void GameOver::handleEvent(const SDL_Event& e)
 {
     if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_RETURN)
     {
-        GameStateManager::instance().changeState(make_shared<PlayState>());
+        GameStateManager::instance().changeState(GameState::ID::Playing);
     }
 }
 
-void GameOver::draw()
+// An autoplayed game restarts on the next update rather than waiting for a key.
+bool GameOver::idle() const
+{
+    return !Game::instance().autoplaying();
+}
+
+void GameOver::update()
+{
+    if (Game::instance().autoplaying())
+        GameStateManager::instance().changeState(GameState::ID::Playing);
+}
+
+void GameOver::draw(const FrameSnapshot& frame)
 {
-    Playfield::instance().draw();
-    TetrominoController::instance().draw();
+    drawPlayfield(frame.playfield);
+    drawTetrominoes(frame);
+    drawHud(frame.scoreBoard);
 }
 
 void GameOver::onEnter()
 {
-    ostringstream ss;
-    ss << "Game Over! "
-       << ScoreBoard::instance().title()
-       << " - press <Enter> to restart";
-    SDL_SetWindowTitle(Game::instance().window(), ss.str().c_str());
+    Game::instance().saveRecording();
+    char score[ScoreBoard::TITLE_CAPACITY];
+    Game::instance().context().scoreBoard().title(score, sizeof(score));
+    char title[ScoreBoard::TITLE_CAPACITY + 48];
+    snprintf(title, sizeof(title), "Game Over! %s - press <Enter> to restart", score);
+    SDL_SetWindowTitle(Game::instance().window(), title);
 }
 
 void GameOver::onExit(ID nextStateID)
@@ -972,6 +1113,9 @@ void BeforeExit::handleEvent(const SDL_Event& e)
     {
         if (e.key.keysym.sym == SDLK_ESCAPE)
         {
+            Game::instance().saveRecording();
+            Game::instance().writeTrace();
+            InputLatency::instance().write();
             SDL_Quit();
             exit(EXIT_SUCCESS);
         }
@@ -988,26 +1132,72 @@ void BeforeExit::onEnter()
         "Press <Esc> to exit or <Enter> to cancel!");
 }
 
-void GameStateManager::handleEvents()
+void GameStateManager::handleEvents(bool wait)
 {
-    for (SDL_Event e; SDL_PollEvent(&e);)
+    TRACE_SCOPE("handleEvents");
+    SDL_Event e;
+    if (wait && SDL_WaitEventTimeout(&e, IDLE_WAIT_MILLIS))
+        handleEvent(e);
+    while (SDL_PollEvent(&e))
+        handleEvent(e);
+}
+
+void GameStateManager::handleEvent(const SDL_Event& e)
+{
+    if (e.type == SDL_RENDER_TARGETS_RESET || e.type == SDL_RENDER_DEVICE_RESET)
     {
-        if (e.type == SDL_QUIT && mCurrState->id() != GameState::ID::BeforeExit)
-        {
-            changeState(make_shared<BeforeExit>());
-            continue;
-        }
-        mCurrState->handleEvent(e);
+        PlayfieldTexture::instance().invalidate();
+        if (e.type == SDL_RENDER_DEVICE_RESET)
+            Hud::instance().invalidate();
+        Game::instance().invalidate();
+        return;
+    }
+    if (e.type == SDL_WINDOWEVENT)
+    {
+        Game::instance().invalidate();
+        return;
+    }
+    if (e.type == SDL_KEYDOWN && !e.key.repeat && e.key.keysym.sym == SDLK_F3)
+    {
+        FrameStats::instance().toggle();
+        Game::instance().invalidate();
+        return;
+    }
+    if (e.type == SDL_KEYDOWN && !e.key.repeat && e.key.keysym.sym == SDLK_F12)
+    {
+        Game::instance().writeTrace();
+        return;
+    }
+    if (e.type == SDL_QUIT && mCurrState->id() != GameState::ID::BeforeExit)
+    {
+        changeState(GameState::ID::BeforeExit);
+        return;
+    }
+    mCurrState->handleEvent(e);
+}
+
+GameState* GameStateManager::stateOf(GameState::ID id)
+{
+    switch (id)
+    {
+    case GameState::ID::Playing: return &mPlaying;
+    case GameState::ID::Paused: return &mPaused;
+    case GameState::ID::GameOver: return &mGameOver;
+    case GameState::ID::BeforeExit: return &mBeforeExit;
+    case GameState::ID::None: break;
     }
+    return nullptr;
 }
 
-void GameStateManager::changeState(const shared_ptr<GameState>& state)
+void GameStateManager::changeState(GameState::ID id)
 {
+    auto state = stateOf(id);
     if (mCurrState)
-        mCurrState->onExit(state->id());
+        mCurrState->onExit(id);
     mLastState = mCurrState;
     mCurrState = state;
     mCurrState->onEnter();
+    Game::instance().invalidate();
 }
 
 void GameStateManager::goBack()
@@ -1017,19 +1207,32 @@ void GameStateManager::goBack()
 
     mCurrState->onExit(mLastState->id());
     mLastState->onEnter();
-    mCurrState.swap(mLastState);
+    swap(mCurrState, mLastState);
+    Game::instance().invalidate();
 }
 
 Game::Game()
 {
     REQUIRES_ZERO(SDL_Init(SDL_INIT_EVERYTHING));
+    mInputs.reserve(INPUT_QUEUE_CAPACITY);
+    mOrigin = Timer::instance().getMicros();
 
     mWindow.reset(SDL_CreateWindow(
         "Tetris", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
         SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_SHOWN));
     REQUIRES_NOT_NULL(mWindow);
 
-    mRenderer.reset(SDL_CreateRenderer(window(), -1, SDL_RENDERER_ACCELERATED));
+    if (Timer::instance().fps() <= 0)
+    {
+        SDL_DisplayMode mode;
+        bool known = SDL_GetWindowDisplayMode(window(), &mode) == 0 && mode.refresh_rate > 0;
+        Timer::instance().configure(Timer::instance().pacing(), known ? mode.refresh_rate : DEFAULT_FPS);
+    }
+
+    Uint32 rendererFlags = SDL_RENDERER_ACCELERATED;
+    if (Timer::instance().pacing() == Timer::Pacing::VSync)
+        rendererFlags |= SDL_RENDERER_PRESENTVSYNC;
+    mRenderer.reset(SDL_CreateRenderer(window(), -1, rendererFlags));
     REQUIRES_NOT_NULL(mRenderer);
     REQUIRES_ZERO(SDL_SetRenderDrawBlendMode(renderer(), SDL_BLENDMODE_BLEND));
 
@@ -1066,30 +1269,325 @@ Game::Game()
 
 void Game::reset()
 {
-    Playfield::instance().reset();
-    ScoreBoard::instance().reset();
-    TetrominoController::instance().reset();
+    if (mPlayer)
+    {
+        mPlayer->start(mSimulation);
+    }
+    else
+    {
+        random_device device;
+        mSimulation.reset((static_cast<uint64_t>(device()) << 32) | device());
+    }
+    if (mBot)
+        mBot->reset();
+    mInputs.clear();
+    mOrigin = Timer::instance().getMicros();
+    if (mThreaded)
+        publish();
+}
+
+// Inputs are stamped with timer time here and turned into simulation time by insertInput,
+// which runs on whichever thread owns the simulation.
+void Game::queueInput(const SDL_Event& e, Input input)
+{
+    auto now = Timer::instance().getMicros();
+    auto age = static_cast<uint64_t>(SDL_GetTicks() - e.key.timestamp) * MICROS_PER_MILLISECOND;
+    TimedInput timed { now > age ? now - age : 0, input, e.type == SDL_KEYDOWN, 0 };
+    if (timed.pressed)
+    {
+        timed.sequence = ++mKeyDowns;
+        if (InputLatency::instance().enabled())
+            InputLatency::instance().onKeyDown(timed.sequence, input, timed.micros);
+    }
+
+    if (!mThreaded)
+        insertInput(timed);
+    else if (!mInbox.push(timed))
+        SDL_Log("input queue full, dropping a key event");
 }
 
-void Game::draw()
+void Game::insertInput(TimedInput timed)
 {
+    if (mInputs.size() == INPUT_QUEUE_CAPACITY)
+    {
+        SDL_Log("input queue full, dropping a key event");
+        return;
+    }
+
+    timed.micros = max(timed.micros > mOrigin ? timed.micros - mOrigin : 0, mSimulation.now());
+    auto position = upper_bound(
+        mInputs.begin(), mInputs.end(), timed,
+        [] (const TimedInput& a, const TimedInput& b) { return a.micros < b.micros; });
+    mInputs.insert(position, timed);
+}
+
+void Game::record(const string& path)
+{
+    mRecordingPath = path;
+    mRecording.events.reserve(RECORDING_RESERVED_EVENTS);
+    mSimulation.record(&mRecording);
+}
+
+void Game::saveRecording()
+{
+    if (!mRecordingPath.empty() && !mRecording.save(mRecordingPath))
+        SDL_Log("%s: failed to save the replay", mRecordingPath.c_str());
+    AllocationCheck::instance().forgive();
+}
+
+void Game::trace(const string& path)
+{
+    mTracePath = path;
+    Trace::nameThread("main");
+    Trace::enable(true);
+}
+
+void Game::writeTrace()
+{
+    if (mTracePath.empty())
+        return;
+    if (!Trace::write(mTracePath))
+        SDL_Log("%s: failed to write the trace", mTracePath.c_str());
+    AllocationCheck::instance().forgive();
+}
+
+void Game::replay(const string& path)
+{
+    if (!mPlayback.load(path))
+        throw runtime_error(path + ": not a readable replay");
+    mPlayer.reset(new ReplayPlayer(mPlayback));
+}
+
+void Game::releaseInputs()
+{
+    mInputs.clear();
+    InputLatency::instance().clearPending();
+    mSimulation.releaseAll();
+}
+
+void Game::advance()
+{
+    auto target = Timer::instance().getMicros() - mOrigin;
+    if (target > mSimulation.now() + MAX_CATCH_UP_MICROS)
+    {
+        mOrigin += target - mSimulation.now() - MAX_CATCH_UP_MICROS;
+        target = mSimulation.now() + MAX_CATCH_UP_MICROS;
+    }
+
+    if (mPlayer)
+    {
+        mPlayer->advanceTo(mSimulation, target);
+        return;
+    }
+
+    auto input = mInputs.cbegin();
+    while (mSimulation.now() + SIMULATION_STEP_MICROS <= target && !mSimulation.gameOver())
+    {
+        for (; input != mInputs.cend() && input->micros <= mSimulation.now(); ++input)
+            apply(*input);
+        applyBotInput();
+        mSimulation.advanceMicros(SIMULATION_STEP_MICROS);
+    }
+    for (; input != mInputs.cend() && !mSimulation.gameOver(); ++input)
+        apply(*input);
+    mInputs.clear();
+}
+
+void Game::apply(const TimedInput& input)
+{
+    mAppliedSequence = max(mAppliedSequence, input.sequence);
+    if (input.pressed)
+        mSimulation.press(input.input);
+    else
+        mSimulation.release(input.input);
+}
+
+void Game::applyBotInput()
+{
+    Input input;
+    if (mBot && mBot->step(context(), mSimulation.now(), input))
+        mSimulation.apply(input);
+}
+
+bool Game::gameOver()
+{
+    return mThreaded ? frame().snapshot.over : mSimulation.gameOver();
+}
+
+void Game::startSimulation()
+{
+    if (!mThreaded || mRunning)
+        return;
+
+    mRunning = true;
+    mSimulationThread = thread(&Game::runSimulation, this);
+    AllocationCheck::instance().forgive();
+}
+
+void Game::stopSimulation()
+{
+    if (!mRunning)
+        return;
+
+    mRunning = false;
+    mSimulationThread.join();
+    for (TimedInput timed; mInbox.pop(timed);) { }
+}
+
+void Game::runSimulation()
+{
+    Trace::nameThread("simulation");
+    auto next = chrono::steady_clock::now();
+    while (mRunning.load(memory_order_acquire))
+    {
+        for (TimedInput timed; mInbox.pop(timed);)
+            insertInput(timed);
+        advance();
+        publish();
+
+        next += chrono::microseconds(SIMULATION_STEP_MICROS);
+        this_thread::sleep_until(next);
+        next = max(next, chrono::steady_clock::now() - chrono::microseconds(SIMULATION_STEP_MICROS));
+    }
+}
+
+void Game::publish()
+{
+    mFrames.back().snapshot.capture(context());
+    mFrames.back().inputSequence = mAppliedSequence;
+    mFrames.publish();
+}
+
+const Game::Frame& Game::frame()
+{
+    if (mThreaded)
+    {
+        mFrames.update();
+        return mFrames.front();
+    }
+    mFrame.snapshot.capture(context());
+    mFrame.inputSequence = mAppliedSequence;
+    return mFrame;
+}
+
+// A newly applied key-down counts as a change even when it moved nothing,
+// so its latency sample ends at the frame that reflects it.
+bool Game::changed(const Frame& frame) const
+{
+    const auto& current = frame.snapshot;
+    const auto& drawn = mDrawn.snapshot;
+    auto same = [] (const Tetromino& a, const Tetromino& b) {
+        return a.type == b.type && a.state == b.state && a.left == b.left && a.bottom == b.bottom;
+    };
+    if (!same(current.active, drawn.active) || current.locking != drawn.locking
+        || current.scoreBoard.revision() != drawn.scoreBoard.revision()
+        || current.holding != drawn.holding || current.held != drawn.held || current.next != drawn.next
+        || frame.inputSequence != mDrawn.inputSequence)
+        return true;
+    return current.playfield.diffRows(drawn.playfield) != 0;
+}
+
+bool Game::draw()
+{
+    const auto& current = frame();
+    if (!mInvalid && !changed(current) && !FrameStats::instance().visible())
+        return false;
+    mInvalid = false;
+    mDrawn = current;
+
     REQUIRES_ZERO(SDL_SetRenderDrawColor(renderer(), BACKGROUND_COLOR));
     REQUIRES_ZERO(SDL_RenderClear(renderer()));
     REQUIRES_ZERO(SDL_RenderCopy(renderer(), mBackground.get(), nullptr, nullptr));
 
-    GameStateManager::instance().draw();
+    GameStateManager::instance().draw(current.snapshot);
+    CellBatch::instance().flush();
 
-    SDL_RenderPresent(Game::instance().renderer());
+    if (FrameStats::instance().visible())
+        FrameStats::instance().draw();
+
+    {
+        TRACE_SCOPE("SDL_RenderPresent");
+        SDL_RenderPresent(Game::instance().renderer());
+    }
+    if (InputLatency::instance().enabled())
+        InputLatency::instance().onPresent(current.inputSequence, Timer::instance().getMicros());
+    return true;
 }
 
-int main()
-{
-    GameStateManager::instance().changeState(make_shared<PauseState>());
-    while (true)
+int main(int argc, char* argv[])
+{
+    auto pacing = Timer::Pacing::Hybrid;
+    int fps = 0;
+    Handling handling;
+    string recordPath;
+    string replayPath;
+    string tracePath;
+    bool threaded = false;
+    bool autoplay = false;
+    AutoPlayer::Settings bot;
+    auto micros = [] (const char* milliseconds) {
+        return static_cast<uint64_t>(max(0., atof(milliseconds)) * MICROS_PER_MILLISECOND);
+    };
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--vsync")
+            pacing = Timer::Pacing::VSync;
+        else if (arg == "--sleep")
+            pacing = Timer::Pacing::Sleep;
+        else if (arg == "--fps" && i + 1 < argc)
+            fps = atoi(argv[++i]);
+        else if (arg == "--das" && i + 1 < argc)
+            handling.dasMicros = micros(argv[++i]);
+        else if (arg == "--arr" && i + 1 < argc)
+            handling.arrMicros = micros(argv[++i]);
+        else if (arg == "--sdf" && i + 1 < argc)
+            handling.softDropMicros = micros(argv[++i]);
+        else if (arg == "--sim-thread")
+            threaded = true;
+        else if (arg == "--bot")
+            autoplay = true;
+        else if (arg == "--bot-pace" && i + 1 < argc)
+            bot.inputMicros = micros(argv[++i]);
+        else if (arg == "--bot-think" && i + 1 < argc)
+            bot.thinkMicros = micros(argv[++i]);
+        else if (arg == "--latency" && i + 1 < argc)
+            InputLatency::instance().enable(argv[++i]);
+        else if (arg == "--trace" && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (arg == "--record" && i + 1 < argc)
+            recordPath = argv[++i];
+        else if (arg == "--replay" && i + 1 < argc)
+            replayPath = argv[++i];
+    }
+    Timer::instance().configure(pacing, fps);
+    Game::instance().setHandling(handling);
+    Game::instance().setThreaded(threaded);
+    if (!tracePath.empty())
+        Game::instance().trace(tracePath);
+    if (!recordPath.empty())
+        Game::instance().record(recordPath);
+    if (!replayPath.empty())
+        Game::instance().replay(replayPath);
+    else if (autoplay)
+        Game::instance().autoplay(bot);
+    Game::instance().reset();
+
+    GameStateManager::instance().changeState(autoplay ? GameState::ID::Playing : GameState::ID::Paused);
+    for (bool wasIdle = true;;)
     {
-        GameStateManager::instance().handleEvents();
-        GameStateManager::instance().update();
-        Game::instance().draw();
-        Timer::instance().tick(MILLISECONDS_PER_FRAME);
+        auto& states = GameStateManager::instance();
+        bool idle = states.idle();
+        states.handleEvents(idle);
+        states.update();
+        bool presented = Game::instance().draw();
+        if (!idle)
+        {
+            Timer::instance().tick(presented);
+            if (!wasIdle)
+                FrameStats::instance().add(Timer::instance().frameMicros());
+        }
+        wasIdle = idle;
+        AllocationCheck::instance().endFrame();
     }
 }
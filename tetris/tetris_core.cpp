@@ -0,0 +1,627 @@
+#include "tetris_core.h"
+#include "replay.h"
+#include "trace.h"
+
+#include <cstdio>
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+
+constexpr ZobristKeys makeZobristKeys()
+{
+    ZobristKeys keys {};
+    uint64_t state = 0x7E7215;
+    for (auto& states : keys.pieces)
+        for (auto& key : states)
+            key = splitMix64(state);
+    for (auto& key : keys.lefts)
+        key = splitMix64(state);
+    for (auto& key : keys.bottoms)
+        key = splitMix64(state);
+    for (auto& key : keys.held)
+        key = splitMix64(state);
+    keys.hasHeld = splitMix64(state);
+    for (auto& types : keys.next)
+        for (auto& key : types)
+            key = splitMix64(state);
+    for (auto& key : keys.bag)
+        key = splitMix64(state);
+    return keys;
+}
+
+}
+
+constexpr ZobristKeys ZOBRIST_KEYS = makeZobristKeys();
+
+void Random::reset(uint64_t seed)
+{
+    mState = 0;
+    next();
+    mState += seed;
+    next();
+}
+
+uint32_t Random::next()
+{
+    constexpr uint64_t MULTIPLIER = 6364136223846793005ull;
+    constexpr uint64_t INCREMENT = 1442695040888963407ull;
+
+    auto state = mState;
+    mState = state * MULTIPLIER + INCREMENT;
+    auto xorshifted = static_cast<uint32_t>(((state >> 18) ^ state) >> 27);
+    auto rotation = static_cast<uint32_t>(state >> 59);
+    return (xorshifted >> rotation) | (xorshifted << ((32 - rotation) & 31));
+}
+
+uint32_t Random::below(uint32_t bound)
+{
+    auto threshold = -bound % bound;
+    for (;;)
+    {
+        auto r = next();
+        if (r >= threshold)
+            return r % bound;
+    }
+}
+
+void TetrominoBag::reset(uint64_t seed)
+{
+    mRandom.reset(seed);
+    mIndex = TETROMINO_TYPES;
+}
+
+TetrominoType TetrominoBag::next()
+{
+    if (mIndex >= mBag.size())
+    {
+        mBag = {
+            TetrominoType::I, TetrominoType::O, TetrominoType::T, TetrominoType::J,
+            TetrominoType::L, TetrominoType::S, TetrominoType::Z,
+        };
+        for (uint32_t i = TETROMINO_TYPES - 1; i > 0; --i)
+            swap(mBag[i], mBag[mRandom.below(i + 1)]);
+        mIndex = 0;
+    }
+    return mBag[mIndex++];
+}
+
+uint64_t TetrominoBag::hash() const
+{
+    uint64_t hash = 0;
+    if (mIndex >= mBag.size())
+    {
+        for (auto key : ZOBRIST_KEYS.bag)
+            hash ^= key;
+        return hash;
+    }
+    for (size_t i = mIndex; i != mBag.size(); ++i)
+        hash ^= ZOBRIST_KEYS.bag[static_cast<int>(mBag[i])];
+    return hash;
+}
+
+TetrominoController::TetrominoController(GameContext& context, State& state) : mContext(context), mState(state)
+{
+}
+
+void TetrominoController::reset(uint64_t seed)
+{
+    mState.bag.reset(seed);
+
+    mState.active = Tetromino::of(make());
+    spawn();
+    mState.holding = false;
+
+    mState.next.clear();
+    for (int i = 0; i != NEXT_PIECES_COUNT; ++i)
+        mState.next.push_back(Tetromino::of(make()));
+
+    mState.updateMicros = 0;
+    mState.hasHeld = false;
+    mState.over = false;
+    mState.garbageQueued = 0;
+    mState.garbageSent = 0;
+    mState.garbageState = seed ^ 0x6A09E667F3BCC909ull;
+    mState.landed = 0;
+}
+
+void TetrominoController::onInput(Input input)
+{
+    switch (input)
+    {
+    case Input::Rotate: tryRotate(); break;
+    case Input::Hold: hold(); break;
+    case Input::SoftDrop: mContext.scoreBoard().onSoftDrop(softDrop()); break;
+    case Input::MoveLeft: moveBy(-1); break;
+    case Input::MoveRight: moveBy(1); break;
+    case Input::HardDrop: land(); break;
+    }
+}
+
+void TetrominoController::update(uint64_t elapsedMicros)
+{
+    if (mState.locking)
+    {
+        auto lockingMicros = mContext.clock().getMicros() - mState.lockMicros;
+        if (lockingMicros >= LOCK_DELAY_MICROS)
+        {
+            land();
+            mState.updateMicros = 0;
+            return;
+        }
+    }
+
+    mState.updateMicros += elapsedMicros;
+    auto rows = mState.updateMicros / mContext.scoreBoard().microsPerRow();
+    if (rows > 0)
+    {
+        mState.updateMicros %= mContext.scoreBoard().microsPerRow();
+        softDrop(static_cast<int>(min<uint64_t>(rows, CELL_ROWS)));
+    }
+}
+
+uint64_t TetrominoController::microsUntilUpdate() const
+{
+    if (mState.locking)
+    {
+        auto lockingMicros = mContext.clock().getMicros() - mState.lockMicros;
+        return lockingMicros >= LOCK_DELAY_MICROS ? 1 : LOCK_DELAY_MICROS - lockingMicros;
+    }
+
+    auto microsPerRow = mContext.scoreBoard().microsPerRow();
+    return mState.updateMicros >= microsPerRow ? 1 : microsPerRow - mState.updateMicros;
+}
+
+uint64_t TetrominoController::hash() const
+{
+    const auto& keys = ZOBRIST_KEYS;
+    auto hash = keys.piece(mState.active) ^ mState.bag.hash();
+    if (mState.holding)
+        hash ^= keys.held[static_cast<int>(mState.held.type)];
+    if (mState.hasHeld)
+        hash ^= keys.hasHeld;
+    for (size_t i = 0; i != mState.next.size(); ++i)
+        hash ^= keys.next[i][static_cast<int>(mState.next[i].type)];
+    return hash;
+}
+
+TetrominoType TetrominoController::make()
+{
+    return mState.bag.next();
+}
+
+Tetromino TetrominoController::next()
+{
+    auto next = mState.next.front();
+    mState.next.pop_front();
+    mState.next.push_back(Tetromino::of(make()));
+    mState.hasHeld = false;
+    return next;
+}
+
+Tetromino TetrominoController::spawnOn(const Playfield& playfield, TetrominoType type)
+{
+    auto piece = Tetromino::of(type);
+    for (int bottom = HIDDEN_ROWS + piece.bottom; bottom >= piece.bottom; --bottom)
+    {
+        if (!playfield.isFilled(piece.split(piece.left, bottom)))
+        {
+            piece.bottom = static_cast<int16_t>(bottom);
+            break;
+        }
+    }
+    return piece;
+}
+
+void TetrominoController::spawn()
+{
+    const auto& playfield = mContext.playfield();
+    mState.active = spawnOn(playfield, mState.active.type);
+    mState.locking = false;
+    mState.lockMicros = 0;
+
+    if (playfield.isFilled(mState.active.split(mState.active.left, mState.active.bottom + 1)))
+    {
+        lock();
+    }
+}
+
+void TetrominoController::moveBy(int columns)
+{
+    if (mState.active.tryMove(mContext.playfield(), columns, 0))
+        unlock();
+}
+
+void TetrominoController::tryRotate()
+{
+    if (mState.active.tryRotate(mContext.playfield()))
+        unlock();
+}
+
+int TetrominoController::softDrop(int rows)
+{
+    if (mState.locking)
+        return 0;
+
+    int height = [this] {
+        auto cells = mState.active.split();
+        auto landingSpot = mContext.playfield().getLandingSpot(cells);
+        return landingSpot[0].row - cells[0].row;
+    }();
+
+    if (height <= rows)
+    {
+        mState.active.bottom += height;
+        lock();
+        return height;
+    }
+
+    mState.active.bottom += rows;
+    return rows;
+}
+
+TetrominoController::HardDropResult TetrominoController::hardDrop()
+{
+    HardDropResult r;
+    r.dropped = softDrop(CELL_ROWS);
+    r.cleard = mContext.playfield().onLanding(mState.active.split(), mState.active.type);
+    return r;
+}
+
+void TetrominoController::lock()
+{
+    mState.locking = true;
+    mState.lockMicros = mContext.clock().getMicros();
+}
+
+void TetrominoController::unlock()
+{
+    if (!mContext.playfield().isFilled(mState.active.split(mState.active.left, mState.active.bottom + 1)))
+    {
+        mState.locking = false;
+    }
+    mState.lockMicros = mContext.clock().getMicros();
+}
+
+void TetrominoController::hold()
+{
+    if (!mState.hasHeld)
+    {
+        auto held = mState.active.type;
+        mState.active = mState.holding ? mState.held : next();
+        spawn();
+        mState.held = Tetromino::of(held);
+        mState.holding = true;
+        mState.hasHeld = true;
+    }
+}
+
+// Clears cancel queued garbage first and send the rest; all that is left rises, with one gap,
+// only when nothing was cleared.
+bool TetrominoController::riseGarbage(int cleared)
+{
+    int lines = GARBAGE_LINES[cleared];
+    int cancelled = min(lines, mState.garbageQueued);
+    mState.garbageQueued -= cancelled;
+    mState.garbageSent += static_cast<uint32_t>(lines - cancelled);
+    if (cleared != 0 || mState.garbageQueued == 0)
+        return true;
+
+    int gap = static_cast<int>(splitMix64(mState.garbageState) % CELL_COLUMNS);
+    auto bits = static_cast<Playfield::Row>(Playfield::FULL_ROW & ~(1u << gap));
+    int rows = mState.garbageQueued;
+    mState.garbageQueued = 0;
+    return mContext.playfield().raise(rows, bits, TetrominoType::I);
+}
+
+// Probed here rather than in Playfield::onLanding, which searches call for every node.
+void TetrominoController::land()
+{
+    TRACE_SCOPE("TetrominoController::land");
+    auto r = hardDrop();
+    ++mState.landed;
+    if (!mState.active.visiable())
+    {
+        mState.over = true;
+        return;
+    }
+
+    mContext.scoreBoard().onClear(r.cleard);
+    mContext.scoreBoard().onHardDrop(r.dropped);
+    if (!riseGarbage(r.cleard))
+    {
+        mState.over = true;
+        return;
+    }
+
+    mState.active = next();
+    spawn();
+    if (mContext.playfield().isFilled(mState.active.split()))
+    {
+        mState.over = true;
+    }
+}
+
+template class BasicPlayfield<CELL_COLUMNS, CELL_ROWS>;
+
+void ScoreBoard::reset()
+{
+    mMicrosPerRow = 1000 * MICROS_PER_MILLISECOND;
+    mCurrLevel = 1;
+    mCurrCleardRows = 0;
+    mTotalCleardRows = 0;
+    mScores = 0;
+    ++mRevision;
+}
+
+void ScoreBoard::onClear(int rows)
+{
+    if (rows > 0)
+    {
+        mScores += array<int, 4>{ 100, 300, 500, 800 }.at(rows - 1) * mCurrLevel;
+        mTotalCleardRows += rows;
+        mCurrCleardRows += rows;
+        tryLevelUp();
+        ++mRevision;
+    }
+}
+
+void ScoreBoard::onSoftDrop(int rows)
+{
+    if (rows > 0)
+    {
+        mScores += min(rows, 20);
+        ++mRevision;
+    }
+}
+
+void ScoreBoard::onHardDrop(int rows)
+{
+    if (rows > 0)
+    {
+        mScores += min(rows * 2, 40);
+        ++mRevision;
+    }
+}
+
+int ScoreBoard::title(char* buffer, size_t size) const
+{
+    return snprintf(buffer, size, "Level: %d Lines: %d Scores: %d", mCurrLevel, mTotalCleardRows, mScores);
+}
+
+void ScoreBoard::tryLevelUp()
+{
+    static array<uint32_t, 15> speeds {
+        1000, 793, 618, 473, 355,
+        262, 190, 135, 94, 64,
+        43, 28, 18, 11, 7
+    };
+
+    if (mCurrLevel >= 15)
+        return;
+
+    int requiredRows = mCurrLevel * 5;
+    if (mCurrCleardRows < requiredRows)
+        return;
+
+    mMicrosPerRow = speeds.at(mCurrLevel) * MICROS_PER_MILLISECOND;
+    mCurrCleardRows -= requiredRows;
+    ++mCurrLevel;
+}
+
+void GameContext::reset(uint64_t seed)
+{
+    mState.seed = seed;
+    mState.playfield.reset();
+    mState.scoreBoard.reset();
+    mController.reset(seed);
+}
+
+void FrameSnapshot::capture(const GameContext& context)
+{
+    const auto& controller = context.controller();
+    playfield = context.playfield();
+    scoreBoard = context.scoreBoard();
+    active = controller.active();
+    ghost = playfield.getLandingSpot(active.split());
+    for (int i = 0; i != NEXT_PIECES_COUNT; ++i)
+        next[i] = controller.nextPieces()[i].type;
+    auto heldPiece = controller.held();
+    held = heldPiece ? heldPiece->type : TetrominoType::I;
+    holding = heldPiece != nullptr;
+    locking = controller.locking();
+    over = context.gameOver();
+}
+
+void Simulation::reset(uint64_t seed)
+{
+    mClock.reset();
+    mContext.reset(seed);
+    releaseAll();
+    if (mRecording)
+        record(mRecording);
+}
+
+void Simulation::record(Replay* replay)
+{
+    mRecording = replay;
+    if (mRecording)
+    {
+        mRecording->seed = seed();
+        mRecording->handling = mHandling;
+        mRecording->endMicros = now();
+        mRecording->events.clear();
+    }
+}
+
+void Simulation::snapshot(Snapshot& snapshot) const
+{
+    mContext.snapshot(snapshot.game);
+    snapshot.micros = now();
+    snapshot.handling = mHandling;
+    snapshot.shift = mShift;
+    snapshot.shiftMicros = mShiftMicros;
+    snapshot.softDropMicros = mSoftDropMicros;
+    snapshot.leftHeld = mLeftHeld;
+    snapshot.rightHeld = mRightHeld;
+    snapshot.shifting = mShifting;
+    snapshot.softDropping = mSoftDropping;
+}
+
+// A replay cannot jump in time, so restoring stops any recording.
+void Simulation::restore(const Snapshot& snapshot)
+{
+    mRecording = nullptr;
+    mContext.restore(snapshot.game);
+    mClock.set(snapshot.micros);
+    mHandling = snapshot.handling;
+    mShift = snapshot.shift;
+    mShiftMicros = snapshot.shiftMicros;
+    mSoftDropMicros = snapshot.softDropMicros;
+    mLeftHeld = snapshot.leftHeld;
+    mRightHeld = snapshot.rightHeld;
+    mShifting = snapshot.shifting;
+    mSoftDropping = snapshot.softDropping;
+}
+
+void Simulation::apply(Input input)
+{
+    log(input, ReplayAction::Apply);
+    mContext.apply(input);
+}
+
+void Simulation::press(Input input)
+{
+    log(input, ReplayAction::Press);
+    switch (input)
+    {
+    case Input::MoveLeft:
+    case Input::MoveRight:
+        (input == Input::MoveLeft ? mLeftHeld : mRightHeld) = true;
+        mShift = input;
+        mShifting = true;
+        // The press itself is the first move, so even with no DAS the next waits an ARR.
+        mShiftMicros = now() + max(mHandling.dasMicros, mHandling.arrMicros);
+        break;
+    case Input::SoftDrop:
+        mSoftDropping = true;
+        mSoftDropMicros = now() + mHandling.softDropMicros;
+        break;
+    default:
+        break;
+    }
+
+    mContext.apply(input);
+    repeat();
+}
+
+void Simulation::release(Input input)
+{
+    log(input, ReplayAction::Release);
+    switch (input)
+    {
+    case Input::MoveLeft:
+    case Input::MoveRight:
+        (input == Input::MoveLeft ? mLeftHeld : mRightHeld) = false;
+        if (mShift == input)
+        {
+            mShift = input == Input::MoveLeft ? Input::MoveRight : Input::MoveLeft;
+            mShifting = mShift == Input::MoveLeft ? mLeftHeld : mRightHeld;
+            mShiftMicros = now() + mHandling.dasMicros;
+        }
+        break;
+    case Input::SoftDrop:
+        mSoftDropping = false;
+        break;
+    default:
+        break;
+    }
+}
+
+// Through release(), so a recording sees the keys come up too.
+void Simulation::releaseAll()
+{
+    if (mLeftHeld)
+        release(Input::MoveLeft);
+    if (mRightHeld)
+        release(Input::MoveRight);
+    if (mSoftDropping)
+        release(Input::SoftDrop);
+    mShifting = false;
+}
+
+void Simulation::advanceMicros(uint64_t micros)
+{
+    while (micros > 0 && !mContext.gameOver())
+    {
+        auto step = min({ micros, mContext.controller().microsUntilUpdate(), microsUntilRepeat() });
+        mClock.advance(step);
+        mContext.update(step);
+        repeat();
+        micros -= step;
+    }
+    mClock.advance(micros);
+
+    if (mRecording)
+        mRecording->endMicros = now();
+}
+
+void Simulation::setHandling(const Handling& handling)
+{
+    mHandling = handling;
+    if (mRecording)
+        mRecording->handling = handling;
+}
+
+void Simulation::log(Input input, ReplayAction action)
+{
+    if (mRecording && !mContext.gameOver())
+        mRecording->events.push_back({ now(), input, action });
+}
+
+void Simulation::repeat()
+{
+    if (mShifting && now() >= mShiftMicros)
+    {
+        if (mHandling.arrMicros == 0)
+        {
+            shiftToWall();
+        }
+        else
+        {
+            mContext.apply(mShift);
+            mShiftMicros += mHandling.arrMicros;
+        }
+    }
+
+    if (mSoftDropping && mHandling.softDropMicros > 0 && now() >= mSoftDropMicros)
+    {
+        mContext.apply(Input::SoftDrop);
+        mSoftDropMicros += mHandling.softDropMicros;
+    }
+}
+
+void Simulation::shiftToWall()
+{
+    for (int i = 0; i != CELL_COLUMNS; ++i)
+    {
+        auto left = mContext.controller().active().left;
+        mContext.apply(mShift);
+        if (mContext.controller().active().left == left)
+            break;
+    }
+}
+
+uint64_t Simulation::microsUntilRepeat() const
+{
+    auto until = [this] (uint64_t micros) { return micros > now() ? micros - now() : 1; };
+
+    uint64_t micros = UINT64_MAX;
+    if (mShifting && (mHandling.arrMicros > 0 || now() < mShiftMicros))
+        micros = min(micros, until(mShiftMicros));
+    if (mSoftDropping && mHandling.softDropMicros > 0)
+        micros = min(micros, until(mSoftDropMicros));
+    return micros;
+}
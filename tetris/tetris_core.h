@@ -0,0 +1,965 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+constexpr int CELL_COLUMNS = 10;
+constexpr int CELL_ROWS = 22;
+constexpr int VISABLE_ROWS = 20;
+constexpr int HIDDEN_ROWS = CELL_ROWS - VISABLE_ROWS;
+constexpr int NEXT_PIECES_COUNT = 3;
+
+struct Object { virtual ~Object() { } };
+struct Cell { int column; int row; };
+using Cells = std::array<Cell, 4>;
+
+enum class Input { MoveLeft, MoveRight, SoftDrop, HardDrop, Rotate, Hold, };
+enum class TetrominoType : uint8_t { I, O, T, J, L, S, Z, };
+constexpr int TETROMINO_TYPES = 7;
+
+class GameContext;
+template <int Columns, int Rows> class BasicPlayfield;
+
+constexpr uint64_t MICROS_PER_MILLISECOND = 1000;
+
+class Clock
+{
+public:
+    virtual ~Clock() { }
+    virtual uint64_t getMicros() const = 0;
+};
+
+class ManualClock final : public Clock
+{
+public:
+    uint64_t getMicros() const override { return mMicros; }
+    void advance(uint64_t micros) { mMicros += micros; }
+    void set(uint64_t micros) { mMicros = micros; }
+    void reset() { mMicros = 0; }
+
+private:
+    uint64_t mMicros = 0;
+};
+
+struct TetrominoShape { Cell cells[4]; int width; int height; };
+struct TetrominoKicks { Cell offset; int count; Cell attempts[5]; };
+
+constexpr TetrominoShape decodeShape(uint16_t shape, int width, int height)
+{
+    TetrominoShape decoded {};
+    for (int i = 0, j = 0; i != 16; ++i)
+    {
+        if (shape & (0x8000 >> i))
+        {
+            decoded.cells[j].column = i % 4;
+            decoded.cells[j++].row = i / 4 - 4;
+        }
+    }
+    decoded.width = width;
+    decoded.height = height;
+    return decoded;
+}
+
+// Indexed by [type][state]; cells are relative to the piece's left and bottom.
+constexpr TetrominoShape TETROMINO_SHAPES[TETROMINO_TYPES][4] = {
+    { decodeShape(0x000F, 4, 1), decodeShape(0x8888, 1, 4), decodeShape(0x000F, 4, 1), decodeShape(0x8888, 1, 4) },
+    { decodeShape(0x00CC, 2, 2), decodeShape(0x00CC, 2, 2), decodeShape(0x00CC, 2, 2), decodeShape(0x00CC, 2, 2) },
+    { decodeShape(0x004E, 3, 2), decodeShape(0x08C8, 2, 3), decodeShape(0x00E4, 3, 2), decodeShape(0x04C4, 2, 3) },
+    { decodeShape(0x008E, 3, 2), decodeShape(0x0C88, 2, 3), decodeShape(0x00E2, 3, 2), decodeShape(0x044C, 2, 3) },
+    { decodeShape(0x002E, 3, 2), decodeShape(0x088C, 2, 3), decodeShape(0x00E8, 3, 2), decodeShape(0x0C44, 2, 3) },
+    { decodeShape(0x006C, 3, 2), decodeShape(0x08C4, 2, 3), decodeShape(0x006C, 3, 2), decodeShape(0x08C4, 2, 3) },
+    { decodeShape(0x00C6, 3, 2), decodeShape(0x04C8, 2, 3), decodeShape(0x00C6, 3, 2), decodeShape(0x04C8, 2, 3) },
+};
+
+// Indexed by the state being rotated into.
+constexpr TetrominoKicks KICKS_3X3[4] = {
+    { {0, -1}, 5, { {0, 0}, {-1, 0}, {-1,-1}, {0, 2}, {-1, 2}, } },
+    { {1, 1}, 5, { {0, 0}, {-1, 0}, {-1, 1}, {0,-2}, {-1,-2}, } },
+    { {-1, 0}, 5, { {0, 0}, {1, 0}, {1,-1}, {0, 2}, {1, 2}, } },
+    { {0, 0}, 5, { {0, 0}, {1, 0}, {1, 1}, {0,-2}, {1,-2}, } },
+};
+constexpr TetrominoKicks KICKS_I[4] = {
+    { {-1, -2}, 5, { {0, 0}, {1, 0}, {-2, 0}, {1,-2}, {-2, 1}, } },
+    { {2, 2}, 5, { {0, 0}, {-2, 0}, {1, 0}, {-2,-1}, {1, 2}, } },
+    { {-2, -1}, 5, { {0, 0}, {-1, 0}, {2, 0}, {-1, 2}, {2,-1}, } },
+    { {1, 1}, 5, { {0, 0}, {2, 0}, {-1, 0}, {2, 1}, {-1,-2}, } },
+};
+constexpr TetrominoKicks KICKS_O[4] = { };
+constexpr const TetrominoKicks* TETROMINO_KICKS[TETROMINO_TYPES] = {
+    KICKS_I, KICKS_O, KICKS_3X3, KICKS_3X3, KICKS_3X3, KICKS_3X3, KICKS_3X3,
+};
+
+struct Tetromino
+{
+    enum State : uint8_t { Up, Right, Down, Left };
+    static constexpr int STATES_COUNT = 4;
+
+    TetrominoType type;
+    State state;
+    int16_t left;
+    int16_t bottom;
+
+    static Tetromino of(TetrominoType type, int columns = CELL_COLUMNS);
+
+    const TetrominoShape& shapeOf(State state) const { return TETROMINO_SHAPES[static_cast<int>(type)][state]; }
+    const TetrominoKicks& kicksInto(State state) const { return TETROMINO_KICKS[static_cast<int>(type)][state]; }
+
+    Cells split(int left, int bottom, State state) const;
+    Cells split(int left, int bottom) const { return split(left, bottom, state); }
+    Cells split() const { return split(left, bottom, state); }
+
+    template <typename Board> bool tryMove(const Board&, int columns, int rows);
+    template <typename Board> bool tryRotate(const Board&);
+
+    int widthOf(State state) const { return shapeOf(state).width; }
+    int width() const { return widthOf(state); }
+    int height() const { return shapeOf(state).height; }
+    bool visiable() const { return bottom > HIDDEN_ROWS; }
+};
+
+inline Tetromino Tetromino::of(TetrominoType type, int columns)
+{
+    const auto& shape = TETROMINO_SHAPES[static_cast<int>(type)][Up];
+    return { type, Up, static_cast<int16_t>((columns - shape.width) / 2), static_cast<int16_t>(shape.height) };
+}
+
+inline Cells Tetromino::split(int left, int bottom, State state) const
+{
+    const auto& cells = shapeOf(state).cells;
+    return {{
+        { left + cells[0].column, bottom + cells[0].row },
+        { left + cells[1].column, bottom + cells[1].row },
+        { left + cells[2].column, bottom + cells[2].row },
+        { left + cells[3].column, bottom + cells[3].row },
+    }};
+}
+
+// Smallest unsigned type with at least Bits bits.
+template <int Bits>
+using UintOf = std::conditional_t<(Bits <= 8), uint8_t, std::conditional_t<(Bits <= 16), uint16_t,
+    std::conditional_t<(Bits <= 32), uint32_t, uint64_t>>>;
+
+inline uint64_t rotateLeft(uint64_t value, int shift)
+{
+    return value << shift | value >> ((64 - shift) & 63);
+}
+
+constexpr uint64_t splitMix64(uint64_t& state)
+{
+    auto z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Random keys for Zobrist hashing: a position hashes to the XOR of the keys of everything
+// in it, so a change costs an XOR per cell or piece rather than a rehash. Keys for the
+// active piece and the queues of the standard game.
+struct ZobristKeys
+{
+    uint64_t pieces[TETROMINO_TYPES][Tetromino::STATES_COUNT];
+    uint64_t lefts[CELL_COLUMNS];
+    uint64_t bottoms[CELL_ROWS + 1];
+    uint64_t held[TETROMINO_TYPES];
+    uint64_t hasHeld;
+    uint64_t next[NEXT_PIECES_COUNT][TETROMINO_TYPES];
+    uint64_t bag[TETROMINO_TYPES];
+
+    uint64_t piece(const Tetromino& piece) const
+    {
+        return pieces[static_cast<int>(piece.type)][piece.state] ^ lefts[piece.left] ^ bottoms[piece.bottom];
+    }
+};
+extern const ZobristKeys ZOBRIST_KEYS;
+
+// Zobrist keys for the cells of a board. A cell's key is its column's key rotated by its row
+// and XORed with its row's key, so a whole row hashes from per-byte tables and a row moved
+// by a line clear is rehashed without visiting its cells.
+template <int Columns, int Rows>
+struct BoardKeys
+{
+    static constexpr int BYTES = (Columns + 7) / 8;
+
+    uint64_t columns[Columns];
+    // Column keys pre-XORed for every pattern of each byte of a row.
+    uint64_t bytes[BYTES][256];
+    uint64_t rows[Rows];
+
+    uint64_t cell(int row, int column) const { return rotateLeft(columns[column], row & 63) ^ rows[row]; }
+    uint64_t row(int row, uint64_t bits) const
+    {
+        uint64_t key = 0;
+        for (int i = 0; i != BYTES; ++i)
+            key ^= bytes[i][bits >> (i * 8) & 0xFF];
+        return rotateLeft(key, row & 63) ^ (__builtin_parityll(bits) ? rows[row] : 0);
+    }
+};
+
+template <int Columns, int Rows>
+constexpr BoardKeys<Columns, Rows> makeBoardKeys()
+{
+    BoardKeys<Columns, Rows> keys {};
+    uint64_t state = 0xB0A2D;
+    for (auto& key : keys.columns)
+        key = splitMix64(state);
+    for (auto& key : keys.rows)
+        key = splitMix64(state);
+    for (int i = 0; i != BoardKeys<Columns, Rows>::BYTES; ++i)
+    {
+        for (int bits = 0; bits != 256; ++bits)
+        {
+            for (int bit = 0; bit != 8 && i * 8 + bit < Columns; ++bit)
+            {
+                if (bits & (1 << bit))
+                    keys.bytes[i][bits] ^= keys.columns[i * 8 + bit];
+            }
+        }
+    }
+    return keys;
+}
+
+// The settled stack, one bitboard word per row with row 0 on top. The row type is the
+// narrowest that holds Columns bits, so every board size gets its own code path.
+template <int Columns, int Rows>
+class BasicPlayfield final
+{
+    static_assert(Columns >= 4 && Columns <= 64, "a row is one machine word and must fit any piece");
+    static_assert(Rows >= 4, "the board must fit any piece");
+
+public:
+    static constexpr int COLUMNS = Columns;
+    static constexpr int ROWS = Rows;
+    using Row = UintOf<Columns>;
+    // One bit per row, for boards of up to 64 rows.
+    using RowMask = UintOf<(Rows <= 32 ? 32 : 64)>;
+    static constexpr Row FULL_ROW = static_cast<Row>(~0ull >> (64 - Columns));
+    static constexpr RowMask ALL_ROWS = static_cast<RowMask>(~0ull >> (64 - (Rows < 64 ? Rows : 64)));
+
+    BasicPlayfield() { reset(); }
+
+    void reset();
+    int onLanding(const Cells&, TetrominoType);
+    Cells getLandingSpot(const Cells&) const;
+    bool isFilled(const Cells&) const;
+
+    void setRow(int row, Row bits, TetrominoType type);
+    // Pushes the stack up and fills the rows opened at the bottom with `bits`, as versus garbage
+    // does. Returns false if filled cells were pushed off the top.
+    bool raise(int rows, Row bits, TetrominoType type);
+    Row row(int row) const { return mRows[row]; }
+    TetrominoType typeAt(int column, int row) const { return mTypes[row][column]; }
+    // Rows whose filled cells or their types differ from other's.
+    RowMask diffRows(const BasicPlayfield& other) const;
+    // Zobrist hash of which cells are filled, kept up to date by every change.
+    uint64_t hash() const { return mHash; }
+
+    // Board features, also kept up to date by every change. Heights count up from the floor,
+    // walls count as taller than any column and as filled cells for row transitions.
+    int height(int column) const { return mHeights[column]; }
+    int wellDepth(int column) const { return mWells[column]; }
+    int holes() const { return mHoleCount; }
+    int holes(int column) const { return mHeights[column] - mFilled[column]; }
+    int rowTransitions() const { return mRowTransitions; }
+
+private:
+    struct Footprint { int top; int bottom; std::array<Row, 4> masks; };
+    using Count = UintOf<(Rows < 256 ? 8 : 16)>;
+    // Bit r of a column is set when row r is filled; boards taller than 64 rows take more words.
+    static constexpr int COLUMN_WORDS = (Rows + 63) / 64;
+    using ColumnBits = std::array<uint64_t, COLUMN_WORDS>;
+
+    static const BoardKeys<Columns, Rows> KEYS;
+
+    static bool footprintOf(const Cells&, Footprint&);
+    bool collides(const Footprint&, int rowOffset) const;
+    static int transitionsOf(Row);
+    void fill(int column, int row);
+    void refreshColumns(uint64_t columns);
+    // First filled row of a column from `row` down, or Rows.
+    int firstFilled(int column, int row) const;
+    static void removeRow(ColumnBits&, int row);
+
+    std::array<Row, Rows> mRows;
+    std::array<std::array<TetrominoType, Columns>, Rows> mTypes;
+    uint64_t mHash;
+
+    std::array<ColumnBits, Columns> mColumns;
+    std::array<Count, Columns> mHeights;
+    std::array<Count, Columns> mFilled;
+    std::array<Count, Columns> mWells;
+    int mHoleCount;
+    int mRowTransitions;
+};
+
+using Playfield = BasicPlayfield<CELL_COLUMNS, CELL_ROWS>;
+
+template <int Columns, int Rows>
+const BoardKeys<Columns, Rows> BasicPlayfield<Columns, Rows>::KEYS = makeBoardKeys<Columns, Rows>();
+
+template <int Columns, int Rows>
+void BasicPlayfield<Columns, Rows>::reset()
+{
+    mRows.fill(0);
+    for (auto& types : mTypes)
+        types.fill(TetrominoType::I);
+    mHash = 0;
+
+    for (auto& column : mColumns)
+        column.fill(0);
+    mHeights.fill(0);
+    mFilled.fill(0);
+    mWells.fill(0);
+    mHoleCount = 0;
+    mRowTransitions = transitionsOf(0) * Rows;
+}
+
+template <int Columns, int Rows>
+typename BasicPlayfield<Columns, Rows>::RowMask BasicPlayfield<Columns, Rows>::diffRows(const BasicPlayfield& other) const
+{
+    static_assert(Rows <= 64, "row masks hold up to 64 rows");
+    RowMask rows = 0;
+    for (int r = 0; r != Rows; ++r)
+    {
+        if (mRows[r] != other.mRows[r])
+        {
+            rows |= RowMask(1) << r;
+            continue;
+        }
+        for (uint64_t bits = mRows[r]; bits != 0; bits &= bits - 1)
+        {
+            int c = __builtin_ctzll(bits);
+            if (mTypes[r][c] != other.mTypes[r][c])
+            {
+                rows |= RowMask(1) << r;
+                break;
+            }
+        }
+    }
+    return rows;
+}
+
+template <int Columns, int Rows>
+void BasicPlayfield<Columns, Rows>::setRow(int row, Row bits, TetrominoType type)
+{
+    mHash ^= KEYS.row(row, mRows[row]) ^ KEYS.row(row, bits);
+    mRowTransitions += transitionsOf(bits) - transitionsOf(mRows[row]);
+    uint64_t changed = mRows[row] ^ bits;
+    for (auto columns = changed; columns != 0; columns &= columns - 1)
+    {
+        int c = __builtin_ctzll(columns);
+        mColumns[c][row / 64] ^= 1ull << row % 64;
+        int filled = bits >> c & 1 ? 1 : -1;
+        mFilled[c] += filled;
+        mHoleCount -= filled;
+    }
+
+    mRows[row] = bits;
+    mTypes[row].fill(type);
+    refreshColumns(changed);
+}
+
+template <int Columns, int Rows>
+bool BasicPlayfield<Columns, Rows>::raise(int rows, Row bits, TetrominoType type)
+{
+    rows = std::min(std::max(rows, 0), Rows);
+    bool fits = true;
+    for (int r = 0; r != rows; ++r)
+        fits = fits && mRows[r] == 0;
+
+    // Top down, so each row is read before it is overwritten; the empty rows above the stack stay.
+    int top = std::max(Rows - *std::max_element(mHeights.begin(), mHeights.end()) - rows, 0);
+    for (int r = top; r != Rows; ++r)
+    {
+        if (r + rows >= Rows)
+        {
+            setRow(r, bits, type);
+            continue;
+        }
+        auto types = mTypes[r + rows];
+        setRow(r, mRows[r + rows], type);
+        mTypes[r] = types;
+    }
+    return fits;
+}
+
+template <int Columns, int Rows>
+int BasicPlayfield<Columns, Rows>::transitionsOf(Row bits)
+{
+    uint64_t wide = bits;
+    return __builtin_popcountll((wide ^ wide >> 1) & (FULL_ROW >> 1)) + !(wide & 1) + !(wide >> (Columns - 1) & 1);
+}
+
+// Everything except the heights, which refreshColumns picks up afterwards.
+template <int Columns, int Rows>
+void BasicPlayfield<Columns, Rows>::fill(int column, int row)
+{
+    // Filling a cell between two filled ones removes two transitions, between two empty ones adds two.
+    int left = column == 0 ? 1 : mRows[row] >> (column - 1) & 1;
+    int right = column == Columns - 1 ? 1 : mRows[row] >> (column + 1) & 1;
+    mRowTransitions += 2 - 2 * (left + right);
+
+    mRows[row] |= Row(1) << column;
+    mColumns[column][row / 64] |= 1ull << row % 64;
+    ++mFilled[column];
+    --mHoleCount;
+}
+
+// Holes are counted as height minus filled cells, so they follow the height changes here.
+template <int Columns, int Rows>
+void BasicPlayfield<Columns, Rows>::refreshColumns(uint64_t columns)
+{
+    for (auto bits = columns; bits != 0; bits &= bits - 1)
+    {
+        int c = __builtin_ctzll(bits);
+        int height = Rows - firstFilled(c, 0);
+        mHoleCount += height - mHeights[c];
+        mHeights[c] = static_cast<Count>(height);
+    }
+
+    // A column's well depth also depends on the heights next to it.
+    columns = (columns | columns << 1 | columns >> 1) & FULL_ROW;
+    for (auto bits = columns; bits != 0; bits &= bits - 1)
+    {
+        int c = __builtin_ctzll(bits);
+        int left = c == 0 ? Rows : mHeights[c - 1];
+        int right = c == Columns - 1 ? Rows : mHeights[c + 1];
+        mWells[c] = static_cast<Count>(std::max(std::min(left, right) - mHeights[c], 0));
+    }
+}
+
+template <int Columns, int Rows>
+int BasicPlayfield<Columns, Rows>::firstFilled(int column, int row) const
+{
+    if (row >= Rows)
+        return Rows;
+
+    const auto& words = mColumns[column];
+    if (COLUMN_WORDS == 1)
+    {
+        auto bits = words[0] >> row;
+        return bits ? row + __builtin_ctzll(bits) : Rows;
+    }
+
+    int word = row / 64;
+    if (auto bits = words[word] >> row % 64)
+        return row + __builtin_ctzll(bits);
+    for (++word; word < COLUMN_WORDS; ++word)
+    {
+        if (words[word])
+            return word * 64 + __builtin_ctzll(words[word]);
+    }
+    return Rows;
+}
+
+// Rows above `row` move down one, carrying across words on tall boards.
+template <int Columns, int Rows>
+void BasicPlayfield<Columns, Rows>::removeRow(ColumnBits& words, int row)
+{
+    uint64_t above = (1ull << row % 64) - 1;
+    if (COLUMN_WORDS == 1)
+    {
+        words[0] = (words[0] & ~(above | (above + 1))) | (words[0] & above) << 1;
+        return;
+    }
+
+    int word = row / 64;
+    uint64_t carry = word > 0 ? words[word - 1] >> 63 : 0;
+    words[word] = (words[word] & ~(above | (above + 1))) | (words[word] & above) << 1 | carry;
+    for (int w = word - 1; w >= 0; --w)
+        words[w] = words[w] << 1 | (w > 0 ? words[w - 1] >> 63 : 0);
+}
+
+template <int Columns, int Rows>
+int BasicPlayfield<Columns, Rows>::onLanding(const Cells& cells, TetrominoType type)
+{
+    int top = Rows;
+    int bottom = -1;
+    uint64_t columns = 0;
+    for (const auto cell: cells)
+    {
+        fill(cell.column, cell.row);
+        mTypes[cell.row][cell.column] = type;
+        mHash ^= KEYS.cell(cell.row, cell.column);
+        columns |= 1ull << cell.column;
+        top = std::min(top, cell.row);
+        bottom = std::max(bottom, cell.row);
+    }
+
+    // Bit i is set when row top + i is full.
+    uint32_t cleared = 0;
+    for (int row = top; row <= bottom; ++row)
+        cleared |= static_cast<uint32_t>(mRows[row] == FULL_ROW) << (row - top);
+    if (cleared == 0)
+    {
+        refreshColumns(columns);
+        return 0;
+    }
+    int full = __builtin_popcount(cleared);
+
+    // Full rows have no transitions; the empty rows replacing them have two each.
+    mRowTransitions += transitionsOf(0) * full;
+
+    // Rows above the stack are empty already, so only the stack moves.
+    int highest = std::min(top, Rows - *std::max_element(mHeights.begin(), mHeights.end()));
+    int dst = bottom;
+    for (int src = bottom; src >= highest; --src)
+    {
+        if (mRows[src] == FULL_ROW)
+            continue;
+        if (dst != src)
+        {
+            mHash ^= KEYS.row(dst, mRows[dst]) ^ KEYS.row(dst, mRows[src]);
+            mRows[dst] = mRows[src];
+            mTypes[dst] = mTypes[src];
+        }
+        --dst;
+    }
+
+    for (int row = highest; row <= dst; ++row)
+    {
+        mHash ^= KEYS.row(row, mRows[row]);
+        mRows[row] = 0;
+    }
+
+    // Top cleared row first, so the ones below it keep their index while rows above shift down.
+    for (auto rows = cleared; rows != 0; rows &= rows - 1)
+    {
+        for (auto& column : mColumns)
+            removeRow(column, top + __builtin_ctz(rows));
+    }
+    for (auto& filled : mFilled)
+        filled -= full;
+    mHoleCount += full * Columns;
+    refreshColumns(FULL_ROW);
+
+    return full;
+}
+
+template <int Columns, int Rows>
+Cells BasicPlayfield<Columns, Rows>::getLandingSpot(const Cells& cells) const
+{
+    int dropped = Rows;
+    for (const auto cell : cells)
+    {
+        if (static_cast<unsigned>(cell.column) >= Columns || static_cast<unsigned>(cell.row) >= Rows)
+            return cells;
+        dropped = std::min(dropped, firstFilled(cell.column, cell.row + 1) - 1 - cell.row);
+    }
+
+    auto landingSpot = cells;
+    for (auto& cell : landingSpot)
+        cell.row += dropped;
+    return landingSpot;
+}
+
+template <int Columns, int Rows>
+bool BasicPlayfield<Columns, Rows>::isFilled(const Cells& cells) const
+{
+    Footprint footprint;
+    return !footprintOf(cells, footprint) || collides(footprint, 0);
+}
+
+template <int Columns, int Rows>
+bool BasicPlayfield<Columns, Rows>::footprintOf(const Cells& cells, Footprint& footprint)
+{
+    footprint.top = cells[0].row;
+    footprint.bottom = cells[0].row;
+    for (const auto cell : cells)
+    {
+        footprint.top = std::min(footprint.top, cell.row);
+        footprint.bottom = std::max(footprint.bottom, cell.row);
+    }
+
+    footprint.masks.fill(0);
+    for (const auto cell : cells)
+    {
+        if (static_cast<unsigned>(cell.column) >= Columns
+            || cell.row - footprint.top >= static_cast<int>(footprint.masks.size()))
+            return false;
+        footprint.masks[cell.row - footprint.top] |= Row(1) << cell.column;
+    }
+    return true;
+}
+
+template <int Columns, int Rows>
+bool BasicPlayfield<Columns, Rows>::collides(const Footprint& footprint, int rowOffset) const
+{
+    int top = footprint.top + rowOffset;
+    int bottom = footprint.bottom + rowOffset;
+    if (top < 0 || bottom >= Rows)
+        return true;
+
+    for (int row = top; row <= bottom; ++row)
+    {
+        if (mRows[row] & footprint.masks[row - top])
+            return true;
+    }
+    return false;
+}
+
+extern template class BasicPlayfield<CELL_COLUMNS, CELL_ROWS>;
+
+template <typename Board>
+bool Tetromino::tryMove(const Board& playfield, int columns, int rows)
+{
+    if (playfield.isFilled(split(left + columns, bottom + rows)))
+        return false;
+
+    left += columns;
+    bottom += rows;
+    return true;
+}
+
+template <typename Board>
+bool Tetromino::tryRotate(const Board& playfield)
+{
+    auto nextState = static_cast<State>((state + 1) % STATES_COUNT);
+    const auto& kicks = kicksInto(nextState);
+    auto leftBase = left + kicks.offset.column;
+    auto bottomBase = bottom + kicks.offset.row;
+
+    for (int i = 0; i != kicks.count; ++i)
+    {
+        auto kickedLeft = leftBase + kicks.attempts[i].column;
+        auto kickedBottom = bottomBase + kicks.attempts[i].row;
+        if (!playfield.isFilled(split(kickedLeft, kickedBottom, nextState)))
+        {
+            left = kickedLeft;
+            bottom = kickedBottom;
+            state = nextState;
+            return true;
+        }
+    }
+    return false;
+}
+
+class ScoreBoard final
+{
+public:
+    ScoreBoard() { reset(); }
+
+    void reset();
+    void onClear(int rows);
+    void onSoftDrop(int rows);
+    void onHardDrop(int rows);
+
+    static constexpr size_t TITLE_CAPACITY = 64;
+
+    // Formats "Level: .. Lines: .. Scores: .." into buffer, snprintf style.
+    int title(char* buffer, size_t size) const;
+    uint64_t microsPerRow() const { return mMicrosPerRow; }
+    int level() const { return mCurrLevel; }
+    int lines() const { return mTotalCleardRows; }
+    int scores() const { return mScores; }
+    uint32_t revision() const { return mRevision; }
+
+private:
+    void tryLevelUp();
+
+    uint64_t mMicrosPerRow;
+    int mCurrLevel;
+    int mCurrCleardRows;
+    int mTotalCleardRows;
+    int mScores;
+    uint32_t mRevision = 0;
+};
+
+// Fixed-capacity FIFO over an inline array; never touches the heap.
+template <typename T, size_t N>
+class RingBuffer final
+{
+public:
+    class const_iterator final
+    {
+    public:
+        const_iterator(const RingBuffer& buffer, size_t index) : mBuffer(buffer), mIndex(index) { }
+
+        const T& operator*() const { return mBuffer[mIndex]; }
+        const T* operator->() const { return &mBuffer[mIndex]; }
+        const_iterator& operator++() { ++mIndex; return *this; }
+        bool operator!=(const const_iterator& other) const { return mIndex != other.mIndex; }
+
+    private:
+        const RingBuffer& mBuffer;
+        size_t mIndex;
+    };
+
+    static constexpr size_t capacity() { return N; }
+    size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+    bool full() const { return mSize == N; }
+    void clear() { mHead = mSize = 0; }
+
+    const T& operator[](size_t index) const { return mItems[(mHead + index) % N]; }
+    const T& front() const { return mItems[mHead]; }
+    const_iterator begin() const { return const_iterator(*this, 0); }
+    const_iterator end() const { return const_iterator(*this, mSize); }
+
+    // Pushing onto a full buffer overwrites the oldest item.
+    void push_back(const T& item)
+    {
+        mItems[(mHead + mSize) % N] = item;
+        if (mSize == N)
+            mHead = (mHead + 1) % N;
+        else
+            ++mSize;
+    }
+
+    void pop_front()
+    {
+        mHead = (mHead + 1) % N;
+        --mSize;
+    }
+
+private:
+    std::array<T, N> mItems;
+    size_t mHead = 0;
+    size_t mSize = 0;
+};
+
+// PCG32 (XSH-RR, 64-bit state) with a fixed stream, so a seed names one sequence everywhere.
+class Random final
+{
+public:
+    explicit Random(uint64_t seed = 0) { reset(seed); }
+
+    void reset(uint64_t seed);
+    uint32_t next();
+    uint32_t below(uint32_t bound);
+
+private:
+    uint64_t mState;
+};
+
+// 7-bag: each bag is a Fisher-Yates shuffle of I, O, T, J, L, S, Z driven by Random.
+class TetrominoBag final
+{
+public:
+    explicit TetrominoBag(uint64_t seed = 0) { reset(seed); }
+
+    void reset(uint64_t seed);
+    TetrominoType next();
+    // Hash of the types still to come from the current bag.
+    uint64_t hash() const;
+
+private:
+    Random mRandom;
+    std::array<TetrominoType, TETROMINO_TYPES> mBag;
+    size_t mIndex;
+};
+
+// Lines a versus opponent receives for clearing 0 to 4 rows at once.
+constexpr int GARBAGE_LINES[5] = { 0, 0, 1, 2, 4 };
+
+class TetrominoController final
+{
+public:
+    static constexpr uint64_t LOCK_DELAY_MICROS = 500 * MICROS_PER_MILLISECOND;
+    struct HardDropResult { int cleard; int dropped; };
+
+    using NextPieces = RingBuffer<Tetromino, NEXT_PIECES_COUNT>;
+    struct State
+    {
+        Tetromino active;
+        Tetromino held;
+        NextPieces next;
+        TetrominoBag bag;
+        uint64_t updateMicros = 0;
+        uint64_t lockMicros = 0;
+        bool locking = false;
+        bool hasHeld = false;
+        bool holding = false;
+        bool over = false;
+        // Versus: garbage lines waiting to rise, lines sent so far and where the next gap goes.
+        int garbageQueued = 0;
+        uint32_t garbageSent = 0;
+        uint64_t garbageState = 0;
+        uint32_t landed = 0;
+    };
+
+    // The state lives in the context's GameSnapshot, so the whole game copies as one block.
+    TetrominoController(GameContext& context, State& state);
+
+    void reset(uint64_t seed);
+    void onInput(Input);
+    void update(uint64_t elapsedMicros);
+    uint64_t microsUntilUpdate() const;
+
+    bool over() const { return mState.over; }
+    bool locking() const { return mState.locking; }
+    uint64_t lockMicros() const { return mState.lockMicros; }
+    const Tetromino& active() const { return mState.active; }
+    const Tetromino* held() const { return mState.holding ? &mState.held : nullptr; }
+    bool canHold() const { return !mState.hasHeld; }
+    // Pieces put down since the last reset, however they were played.
+    uint32_t landed() const { return mState.landed; }
+    const NextPieces& nextPieces() const { return mState.next; }
+    // Queues garbage from a versus opponent; it rises when a piece lands without clearing,
+    // after the lines that piece's clears would send have cancelled out as much as they can.
+    void receiveGarbage(int lines) { mState.garbageQueued += lines; }
+    int garbageQueued() const { return mState.garbageQueued; }
+    // Running total, for the opponent to pick up the difference.
+    uint32_t garbageSent() const { return mState.garbageSent; }
+    // Picks where gaps go from here on. reset() seeds this from the piece seed, so opponents on
+    // the same pieces need streams of their own or their garbage mirrors each other's.
+    void seedGarbage(uint64_t seed) { mState.garbageState = seed; }
+    // Hash of the active piece, hold, next queue and bag; a handful of XORs.
+    uint64_t hash() const;
+    // Where a new piece of this type appears on the board.
+    static Tetromino spawnOn(const Playfield&, TetrominoType);
+
+private:
+    TetrominoType make();
+    Tetromino next();
+    void spawn();
+    void moveBy(int columns);
+    void tryRotate();
+    int softDrop(int rows = 1);
+    HardDropResult hardDrop();
+    void lock();
+    void unlock();
+    void hold();
+    void land();
+    bool riseGarbage(int cleared);
+
+    GameContext& mContext;
+    State& mState;
+};
+
+// Everything a game is, as plain bytes: snapshot and restore are a single copy, for saving
+// and resuming or for branching a search off any position.
+struct GameSnapshot
+{
+    Playfield playfield;
+    ScoreBoard scoreBoard;
+    TetrominoController::State pieces;
+    uint64_t seed = 0;
+};
+static_assert(std::is_trivially_copyable<GameSnapshot>::value, "game snapshots are copied as plain bytes");
+
+// Everything one game needs, with time supplied by the caller's clock.
+class GameContext final
+{
+public:
+    explicit GameContext(Clock& clock, uint64_t seed = 0) : mClock(clock), mController(*this, mState.pieces) { reset(seed); }
+    GameContext(const GameContext&) = delete;
+    GameContext& operator=(const GameContext&) = delete;
+
+    void reset(uint64_t seed);
+    uint64_t seed() const { return mState.seed; }
+    void apply(Input input) { if (!gameOver()) mController.onInput(input); }
+    void update(uint64_t elapsedMicros) { if (!gameOver()) mController.update(elapsedMicros); }
+    bool gameOver() const { return mController.over(); }
+
+    const Clock& clock() const { return mClock; }
+    Playfield& playfield() { return mState.playfield; }
+    const Playfield& playfield() const { return mState.playfield; }
+    ScoreBoard& scoreBoard() { return mState.scoreBoard; }
+    const ScoreBoard& scoreBoard() const { return mState.scoreBoard; }
+    TetrominoController& controller() { return mController; }
+    const TetrominoController& controller() const { return mController; }
+    uint64_t hash() const { return mState.playfield.hash() ^ mController.hash(); }
+
+    const GameSnapshot& state() const { return mState; }
+    void snapshot(GameSnapshot& state) const { state = mState; }
+    void restore(const GameSnapshot& state) { mState = state; }
+
+private:
+    Clock& mClock;
+    GameSnapshot mState;
+    TetrominoController mController;
+};
+
+// What a frame shows, copied out of a GameContext so it can be handed to another thread.
+struct FrameSnapshot
+{
+    Playfield playfield;
+    ScoreBoard scoreBoard;
+    Tetromino active;
+    Cells ghost;
+    std::array<TetrominoType, NEXT_PIECES_COUNT> next;
+    TetrominoType held;
+    bool holding;
+    bool locking;
+    bool over;
+
+    void capture(const GameContext&);
+};
+static_assert(std::is_trivially_copyable<FrameSnapshot>::value, "snapshots are copied as plain bytes");
+
+enum class ReplayAction : uint8_t { Press, Release, Apply, };
+struct ReplayEvent { uint64_t micros; Input input; ReplayAction action; };
+struct Replay;
+
+// Auto-repeat timings for held keys; an ARR of zero shifts straight to the wall.
+struct Handling
+{
+    uint64_t dasMicros = 167 * MICROS_PER_MILLISECOND;
+    uint64_t arrMicros = 33 * MICROS_PER_MILLISECOND;
+    uint64_t softDropMicros = 33 * MICROS_PER_MILLISECOND;
+};
+
+// Windowless game driven purely by inputs and elapsed time.
+class Simulation final
+{
+public:
+    // A GameSnapshot plus the clock, handling and held keys.
+    struct Snapshot
+    {
+        GameSnapshot game;
+        uint64_t micros;
+        Handling handling;
+        Input shift;
+        uint64_t shiftMicros;
+        uint64_t softDropMicros;
+        bool leftHeld;
+        bool rightHeld;
+        bool shifting;
+        bool softDropping;
+    };
+
+    explicit Simulation(uint64_t seed = 0) : mContext(mClock, seed) { }
+
+    void reset(uint64_t seed);
+    void record(Replay* replay);
+    void apply(Input input);
+    void press(Input);
+    void release(Input);
+    void releaseAll();
+    void advance(uint32_t milliseconds) { advanceMicros(milliseconds * MICROS_PER_MILLISECOND); }
+    void advanceMicros(uint64_t micros);
+
+    void snapshot(Snapshot&) const;
+    void restore(const Snapshot&);
+
+    void setHandling(const Handling&);
+    const Handling& handling() const { return mHandling; }
+    uint64_t now() const { return mClock.getMicros(); }
+    uint64_t seed() const { return mContext.seed(); }
+    bool gameOver() const { return mContext.gameOver(); }
+    GameContext& context() { return mContext; }
+    const GameContext& context() const { return mContext; }
+
+private:
+    void repeat();
+    void shiftToWall();
+    uint64_t microsUntilRepeat() const;
+
+    void log(Input, ReplayAction);
+
+    ManualClock mClock;
+    GameContext mContext;
+    Handling mHandling;
+    Replay* mRecording = nullptr;
+    Input mShift = Input::MoveLeft;
+    uint64_t mShiftMicros = 0;
+    uint64_t mSoftDropMicros = 0;
+    bool mLeftHeld = false;
+    bool mRightHeld = false;
+    bool mShifting = false;
+    bool mSoftDropping = false;
+};
+static_assert(std::is_trivially_copyable<Simulation::Snapshot>::value, "snapshots are copied as plain bytes");
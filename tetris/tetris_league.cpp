@@ -0,0 +1,130 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "league.h"
+
+using namespace std;
+
+namespace
+{
+
+// Ten comma-separated numbers, in Feature order, as tetris_tune prints them.
+bool parseWeights(const char* text, Weights& weights)
+{
+    for (int i = 0; i != FEATURES_COUNT; ++i)
+    {
+        char* end;
+        weights.values[i] = strtof(text, &end);
+        if (end == text || *end != (i + 1 == FEATURES_COUNT ? '\0' : ','))
+            return false;
+        text = end + 1;
+    }
+    return true;
+}
+
+}
+
+// Runs a league of bot (or replayed) boards in versus pairs and prints one JSON object per
+// second of wall time, then a summary.
+int main(int argc, char* argv[])
+{
+    League::Settings settings;
+    int threads = 0;
+    double seconds = 10;
+    bool pinned = true;
+    string replayPath;
+    vector<Weights> entrants;
+    for (int i = 1; i < argc; ++i)
+    {
+        Weights weights;
+        if (strcmp(argv[i], "--boards") == 0 && i + 1 < argc)
+            settings.boards = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+            seconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "--tick-ms") == 0 && i + 1 < argc)
+            settings.tickMicros = strtoull(argv[++i], nullptr, 10) * MICROS_PER_MILLISECOND;
+        else if (strcmp(argv[i], "--pieces") == 0 && i + 1 < argc)
+            settings.maxPieces = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            settings.seed = strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replayPath = argv[++i];
+        else if (strcmp(argv[i], "--entrant") == 0 && i + 1 < argc && parseWeights(argv[i + 1], weights))
+        {
+            entrants.push_back(weights);
+            ++i;
+        }
+        else if (strcmp(argv[i], "--no-pin") == 0)
+            pinned = false;
+        else
+        {
+            fprintf(stderr, "usage: %s [--boards N] [--threads N] [--seconds N] [--tick-ms N] [--pieces N] "
+                "[--seed N] [--replay FILE] [--entrant W,W,...]... [--no-pin]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    Replay replay;
+    if (!replayPath.empty() && !replay.load(replayPath))
+    {
+        fprintf(stderr, "cannot load %s\n", replayPath.c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (!entrants.empty())
+        settings.entrants = entrants;
+
+    WorkStealingPool pool(threads, pinned);
+    League league(pool, settings);
+    // Every second board replays the file against a bot.
+    if (!replayPath.empty())
+    {
+        for (int i = 1; i < league.size(); i += 2)
+            league.assign(i, replay);
+    }
+
+    auto start = chrono::steady_clock::now();
+    auto report = start;
+    League::Stats last;
+    for (;;)
+    {
+        league.tick();
+        auto now = chrono::steady_clock::now();
+        double total = chrono::duration<double>(now - start).count();
+        double elapsed = chrono::duration<double>(now - report).count();
+        if (elapsed < 1 && total < seconds)
+            continue;
+
+        const auto& stats = league.stats();
+        printf("{ \"seconds\": %.1f, \"boards\": %d, \"threads\": %d, \"updates_per_second\": %.0f, "
+               "\"ticks_per_second\": %.1f, \"matches\": %llu, \"draws\": %llu, \"garbage\": %llu }\n",
+            total, league.size(), pool.size(), (stats.updates - last.updates) / elapsed,
+            (stats.ticks - last.ticks) / elapsed, static_cast<unsigned long long>(stats.matches),
+            static_cast<unsigned long long>(stats.draws), static_cast<unsigned long long>(stats.garbage));
+        fflush(stdout);
+        last = stats;
+        report = now;
+        if (total >= seconds)
+            break;
+    }
+
+    const auto& stats = league.stats();
+    double total = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    vector<int> wins(settings.entrants.size());
+    for (int i = 0; i != league.size(); ++i)
+        wins[i % wins.size()] += league.wins(i);
+    printf("{ \"summary\": true, \"updates\": %llu, \"updates_per_second\": %.0f, \"pieces_per_second\": %.0f, "
+           "\"matches\": %llu, \"draws\": %llu, \"wins\": [",
+        static_cast<unsigned long long>(stats.updates), stats.updates / total, stats.pieces / total,
+        static_cast<unsigned long long>(stats.matches), static_cast<unsigned long long>(stats.draws));
+    for (size_t i = 0; i != wins.size(); ++i)
+        printf("%s%d", i == 0 ? "" : ", ", wins[i]);
+    printf("] }\n");
+    return EXIT_SUCCESS;
+}
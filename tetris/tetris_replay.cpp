@@ -0,0 +1,91 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#include "replay.h"
+
+using namespace std;
+
+namespace
+{
+
+// Records a scripted game that lets go of every key at once while some are held, as pausing
+// does, saves and loads it, replays it and compares the two games.
+bool checkRoundTrip()
+{
+    Replay recorded;
+    Simulation live(7);
+    live.record(&recorded);
+    live.press(Input::MoveLeft);
+    live.advance(50);
+    live.releaseAll();
+    live.advance(600);
+    live.press(Input::MoveRight);
+    live.press(Input::SoftDrop);
+    live.advance(300);
+    live.releaseAll();
+    live.advance(400);
+    live.apply(Input::HardDrop);
+    live.press(Input::MoveLeft);
+    live.press(Input::MoveRight);
+    live.advance(250);
+    live.releaseAll();
+    live.advance(1000);
+
+    stringstream stream;
+    Replay replay;
+    if (!recorded.save(stream) || !replay.load(stream))
+        return false;
+
+    Simulation replayed;
+    ReplayPlayer player(replay);
+    player.start(replayed);
+    player.runToEnd(replayed);
+    return replayed.now() == live.now() && replayed.context().hash() == live.context().hash()
+        && replayed.context().playfield().diffRows(live.context().playfield()) == 0;
+}
+
+}
+
+// Re-runs recorded games as fast as possible and prints one JSON object per replay.
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s REPLAY... | --check\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (strcmp(argv[1], "--check") == 0)
+    {
+        bool same = checkRoundTrip();
+        printf("{ \"check\": \"round_trip\", \"passed\": %s }\n", same ? "true" : "false");
+        return same ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    Replay replay;
+    Simulation simulation;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!replay.load(string(argv[i])))
+        {
+            fprintf(stderr, "%s: not a readable replay\n", argv[i]);
+            ++failures;
+            continue;
+        }
+
+        ReplayPlayer player(replay);
+        player.start(simulation);
+        player.runToEnd(simulation);
+
+        const auto& scoreBoard = simulation.context().scoreBoard();
+        printf("{ \"replay\": \"%s\", \"seed\": %llu, \"micros\": %llu, \"game_over\": %s, "
+               "\"level\": %d, \"lines\": %d, \"scores\": %d }\n",
+            argv[i], static_cast<unsigned long long>(replay.seed),
+            static_cast<unsigned long long>(simulation.now()), simulation.gameOver() ? "true" : "false",
+            scoreBoard.level(), scoreBoard.lines(), scoreBoard.scores());
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,110 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "selfplay.h"
+
+using namespace std;
+
+namespace
+{
+
+double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void printWeights(const Weights& weights)
+{
+    printf("[");
+    for (int i = 0; i != FEATURES_COUNT; ++i)
+        printf("%s%.4f", i == 0 ? "" : ", ", weights.values[i]);
+    printf("]");
+}
+
+// The same batch of games on 1, 2, 4, ... threads, to see how close to linear the speedup is.
+void measureScaling(int maxThreads, const TuneSettings& settings)
+{
+    const vector<Weights> weights { Weights::defaults() };
+    vector<uint64_t> seeds;
+    for (int i = 0; i != settings.games; ++i)
+        seeds.push_back(settings.seed + i);
+
+    vector<GameResult> results;
+    double baseline = 0;
+    for (int threads = 1;; threads = min(threads * 2, maxThreads))
+    {
+        WorkStealingPool pool(threads);
+        auto start = chrono::steady_clock::now();
+        playGames(pool, weights, seeds, settings.maxPieces, results);
+        double gamesPerSecond = seeds.size() / secondsSince(start);
+        if (threads == 1)
+            baseline = gamesPerSecond;
+
+        printf("{ \"threads\": %d, \"games\": %zu, \"games_per_second\": %.2f, \"speedup\": %.2f }\n",
+            threads, seeds.size(), gamesPerSecond, gamesPerSecond / baseline);
+        fflush(stdout);
+        if (threads == maxThreads)
+            break;
+    }
+}
+
+}
+
+// Tunes the bot's evaluation weights by self-play and prints one JSON object per generation.
+int main(int argc, char* argv[])
+{
+    TuneSettings settings;
+    int threads = 0;
+    int generations = 20;
+    bool scaling = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--generations") == 0 && i + 1 < argc)
+            generations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--population") == 0 && i + 1 < argc)
+            settings.population = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--games") == 0 && i + 1 < argc)
+            settings.games = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--pieces") == 0 && i + 1 < argc)
+            settings.maxPieces = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            settings.seed = strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--scaling") == 0)
+            scaling = true;
+        else
+        {
+            fprintf(stderr, "usage: %s [--threads N] [--generations N] [--population N] [--games N] "
+                "[--pieces N] [--seed N] [--scaling]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (scaling)
+    {
+        if (threads <= 0)
+            threads = max(1, static_cast<int>(thread::hardware_concurrency()));
+        measureScaling(threads, settings);
+        return EXIT_SUCCESS;
+    }
+
+    WorkStealingPool pool(threads);
+    GeneticTuner tuner(pool, settings);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i != generations; ++i)
+    {
+        auto best = tuner.step();
+        printf("{ \"generation\": %d, \"threads\": %d, \"games_per_second\": %.2f, \"fitness\": %.1f, "
+               "\"lines\": %.1f, \"scores\": %.1f, \"weights\": ",
+            tuner.generation(), pool.size(), tuner.gamesPlayed() / secondsSince(start),
+            best.fitness, best.lines, best.scores);
+        printWeights(best.weights);
+        printf(" }\n");
+        fflush(stdout);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,140 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+
+void pinToCore(thread& worker, int core)
+{
+#ifdef __linux__
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    CPU_SET(core, &cores);
+    pthread_setaffinity_np(worker.native_handle(), sizeof(cores), &cores);
+#else
+    (void)worker;
+    (void)core;
+#endif
+}
+
+}
+
+WorkStealingPool::WorkStealingPool(int threads, bool pinned)
+{
+    int cores = max(1, static_cast<int>(thread::hardware_concurrency()));
+    if (threads <= 0)
+        threads = cores;
+
+    for (int i = 0; i != threads; ++i)
+        mWorkers.emplace_back(new Worker);
+    for (int i = 0; i != threads; ++i)
+    {
+        mWorkers[i]->thread = thread(&WorkStealingPool::work, this, i);
+        if (pinned)
+            pinToCore(mWorkers[i]->thread, i % cores);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mStart.notify_all();
+    for (auto& worker : mWorkers)
+        worker->thread.join();
+}
+
+void WorkStealingPool::run(size_t count, const Task& task)
+{
+    if (count == 0)
+        return;
+
+    // Workers are all parked between batches, so their shares can be handed out directly.
+    size_t workers = mWorkers.size();
+    for (size_t i = 0; i != workers; ++i)
+    {
+        lock_guard<mutex> lock(mWorkers[i]->mutex);
+        mWorkers[i]->begin = count * i / workers;
+        mWorkers[i]->end = count * (i + 1) / workers;
+    }
+
+    unique_lock<mutex> lock(mMutex);
+    mTask = &task;
+    mBusy = static_cast<int>(workers);
+    ++mBatch;
+    mStart.notify_all();
+    mDone.wait(lock, [this] { return mBusy == 0; });
+    mTask = nullptr;
+}
+
+void WorkStealingPool::work(int worker)
+{
+    uint64_t batch = 0;
+    for (;;)
+    {
+        const Task* task;
+        {
+            unique_lock<mutex> lock(mMutex);
+            mStart.wait(lock, [&] { return mStopping || mBatch != batch; });
+            if (mStopping)
+                return;
+            batch = mBatch;
+            task = mTask;
+        }
+
+        size_t index;
+        while (take(worker, index) || steal(worker, index))
+            (*task)(index, worker);
+
+        lock_guard<mutex> lock(mMutex);
+        if (--mBusy == 0)
+            mDone.notify_one();
+    }
+}
+
+bool WorkStealingPool::take(int worker, size_t& index)
+{
+    auto& own = *mWorkers[worker];
+    lock_guard<mutex> lock(own.mutex);
+    if (own.begin == own.end)
+        return false;
+    index = own.begin++;
+    return true;
+}
+
+bool WorkStealingPool::steal(int thief, size_t& index)
+{
+    int workers = size();
+    for (int i = 1; i != workers; ++i)
+    {
+        auto& victim = *mWorkers[(thief + i) % workers];
+        size_t begin;
+        size_t end;
+        {
+            lock_guard<mutex> lock(victim.mutex);
+            if (victim.begin == victim.end)
+                continue;
+            end = victim.end;
+            begin = victim.end - (victim.end - victim.begin + 1) / 2;
+            victim.end = begin;
+        }
+
+        auto& own = *mWorkers[thief];
+        lock_guard<mutex> lock(own.mutex);
+        own.begin = begin + 1;
+        own.end = end;
+        index = begin;
+        return true;
+    }
+    return false;
+}
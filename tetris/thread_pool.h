@@ -0,0 +1,52 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that run batches of indexed tasks. Each worker starts on an
+// equal share of the indices; one that runs dry steals the back half of another's share,
+// so uneven tasks (a game that tops out early next to one that runs long) still balance.
+class WorkStealingPool final
+{
+public:
+    using Task = std::function<void (size_t index, int worker)>;
+
+    // Zero threads means one per hardware thread. Pinned workers each stay on one core, where
+    // the OS allows it; with the same count every batch, a worker also starts on the same share.
+    explicit WorkStealingPool(int threads = 0, bool pinned = false);
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    int size() const { return static_cast<int>(mWorkers.size()); }
+    // Calls task(index, worker) once for every index below count; returns when all are done.
+    void run(size_t count, const Task& task);
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        size_t begin = 0;
+        size_t end = 0;
+        std::thread thread;
+    };
+
+    void work(int worker);
+    bool take(int worker, size_t& index);
+    bool steal(int thief, size_t& index);
+
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mStart;
+    std::condition_variable mDone;
+    const Task* mTask = nullptr;
+    uint64_t mBatch = 0;
+    int mBusy = 0;
+    bool mStopping = false;
+};
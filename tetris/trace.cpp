@@ -0,0 +1,112 @@
+#include "trace.h"
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+using namespace std;
+
+namespace
+{
+
+struct TraceEvent { const char* name; uint64_t start; uint64_t duration; };
+
+struct ThreadEvents
+{
+    const char* name = nullptr;
+    // Holds the name of a thread that never named itself.
+    char number[24];
+    atomic<uint64_t> count { 0 };
+    array<TraceEvent, Trace::EVENTS_PER_THREAD> events;
+};
+
+// Static storage, so tracing never allocates on the hot path.
+ThreadEvents gThreads[Trace::MAX_THREADS];
+int gThreadCount = 0;
+int gUnnamedCount = 0;
+mutex gThreadsMutex;
+thread_local ThreadEvents* tThread = nullptr;
+// Set once a thread has been turned away for lack of buffers, so it does not ask again.
+thread_local bool tTurnedAway = false;
+
+// A buffer has a single writer: a name claims its own, an unnamed thread gets a fresh one.
+ThreadEvents* claim(const char* name)
+{
+    lock_guard<mutex> lock(gThreadsMutex);
+    for (int i = 0; name && i != gThreadCount; ++i)
+    {
+        if (strcmp(gThreads[i].name, name) == 0)
+            return &gThreads[i];
+    }
+    if (gThreadCount == Trace::MAX_THREADS)
+        return nullptr;
+
+    auto thread = &gThreads[gThreadCount++];
+    if (!name)
+    {
+        snprintf(thread->number, sizeof(thread->number), "thread-%d", ++gUnnamedCount);
+        name = thread->number;
+    }
+    thread->name = name;
+    return thread;
+}
+
+}
+
+atomic<bool> Trace::sEnabled { false };
+
+uint64_t Trace::now()
+{
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Trace::nameThread(const char* name)
+{
+    tThread = claim(name);
+    tTurnedAway = !tThread;
+}
+
+void Trace::record(const char* name, uint64_t startMicros, uint64_t endMicros)
+{
+    if (!tThread && (tTurnedAway || !(tThread = claim(nullptr))))
+    {
+        tTurnedAway = true;
+        return;
+    }
+
+    auto count = tThread->count.load(memory_order_relaxed);
+    tThread->events[count % EVENTS_PER_THREAD] = { name, startMicros, endMicros - startMicros };
+    tThread->count.store(count + 1, memory_order_release);
+}
+
+// Other threads may still be recording; the oldest events of a wrapped buffer can be torn.
+bool Trace::write(const string& path)
+{
+    auto file = fopen(path.c_str(), "w");
+    if (!file)
+        return false;
+
+    lock_guard<mutex> lock(gThreadsMutex);
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    for (int tid = 0; tid != gThreadCount; ++tid)
+    {
+        const auto& thread = gThreads[tid];
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", tid, thread.name);
+        first = false;
+
+        auto count = thread.count.load(memory_order_acquire);
+        for (auto i = count > EVENTS_PER_THREAD ? count - EVENTS_PER_THREAD : 0; i != count; ++i)
+        {
+            const auto& event = thread.events[i % EVENTS_PER_THREAD];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"dur\":%llu}",
+                event.name, tid, static_cast<unsigned long long>(event.start),
+                static_cast<unsigned long long>(event.duration));
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
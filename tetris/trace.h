@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Scoped probes written to per-thread ring buffers and dumped as Chrome trace JSON
+// (chrome://tracing, Perfetto). Compiled in with TETRIS_TRACE, switched on at runtime.
+class Trace final
+{
+public:
+    static constexpr size_t EVENTS_PER_THREAD = 1 << 15;
+    static constexpr int MAX_THREADS = 8;
+
+    static void enable(bool enabled) { sEnabled.store(enabled, std::memory_order_relaxed); }
+    static bool enabled() { return sEnabled.load(std::memory_order_relaxed); }
+    static uint64_t now();
+
+    // Names the calling thread; a later thread with the same name takes over its buffer. Threads
+    // that record without a name are numbered, each with a buffer of its own.
+    static void nameThread(const char* name);
+    static void record(const char* name, uint64_t startMicros, uint64_t endMicros);
+    static bool write(const std::string& path);
+
+private:
+    static std::atomic<bool> sEnabled;
+};
+
+class TraceScope final
+{
+public:
+    explicit TraceScope(const char* name) : mName(__builtin_expect(Trace::enabled(), 0) ? name : nullptr)
+    {
+        if (__builtin_expect(mName != nullptr, 0))
+            mStart = Trace::now();
+    }
+
+    ~TraceScope()
+    {
+        if (__builtin_expect(mName != nullptr, 0))
+            Trace::record(mName, mStart, Trace::now());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* mName;
+    uint64_t mStart = 0;
+};
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#ifdef TETRIS_TRACE
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) do { } while (0)
+#endif
@@ -0,0 +1,91 @@
+#include "transposition.h"
+
+#include <new>
+
+using namespace std;
+
+TranspositionTable::TranspositionTable(size_t bytes)
+{
+    size_t count = 1;
+    while (count * 2 * sizeof(Bucket) <= bytes)
+        count *= 2;
+
+    mStorage.reset(new char[count * sizeof(Bucket) + alignof(Bucket) - 1]);
+    auto address = reinterpret_cast<uintptr_t>(mStorage.get());
+    auto aligned = (address + alignof(Bucket) - 1) & ~static_cast<uintptr_t>(alignof(Bucket) - 1);
+    mBuckets = reinterpret_cast<Bucket*>(aligned);
+    for (size_t i = 0; i != count; ++i)
+        new (&mBuckets[i]) Bucket;
+    mMask = count - 1;
+    clear();
+}
+
+void TranspositionTable::clear()
+{
+    for (size_t i = 0; i <= mMask; ++i)
+    {
+        for (int way = 0; way != WAYS; ++way)
+        {
+            mBuckets[i].checks[way].store(0, memory_order_relaxed);
+            mBuckets[i].data[way].store(0, memory_order_relaxed);
+        }
+    }
+}
+
+uint64_t TranspositionTable::pack(const Entry& entry, uint64_t generation)
+{
+    return USED | generation << GENERATION_SHIFT | static_cast<uint64_t>(entry.depth) << 48
+        | static_cast<uint64_t>(entry.move) << 32 | static_cast<uint32_t>(entry.value);
+}
+
+TranspositionTable::Entry TranspositionTable::unpack(uint64_t data)
+{
+    return { static_cast<int32_t>(static_cast<uint32_t>(data)), static_cast<uint16_t>(data >> 32),
+        static_cast<uint8_t>(data >> 48) };
+}
+
+bool TranspositionTable::probe(uint64_t key, Entry& entry) const
+{
+    const auto& bucket = mBuckets[key & mMask];
+    for (int way = 0; way != WAYS; ++way)
+    {
+        auto data = bucket.data[way].load(memory_order_relaxed);
+        if ((data & USED) && (bucket.checks[way].load(memory_order_relaxed) ^ data) == key)
+        {
+            entry = unpack(data);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TranspositionTable::store(uint64_t key, const Entry& entry)
+{
+    auto& bucket = mBuckets[key & mMask];
+    auto generation = mGeneration.load(memory_order_relaxed) & GENERATION_MASK;
+
+    int victim = 0;
+    int lowest = INT32_MAX;
+    for (int way = 0; way != WAYS; ++way)
+    {
+        auto data = bucket.data[way].load(memory_order_relaxed);
+        if ((bucket.checks[way].load(memory_order_relaxed) ^ data) == key)
+        {
+            victim = way;
+            break;
+        }
+
+        int rank = -1;
+        if (data & USED)
+            rank = ((data >> GENERATION_SHIFT & GENERATION_MASK) == generation ? 256 : 0) + static_cast<uint8_t>(data >> 48);
+        if (rank < lowest)
+        {
+            victim = way;
+            lowest = rank;
+        }
+    }
+
+    auto data = pack(entry, generation);
+    bucket.data[victim].store(data, memory_order_relaxed);
+    bucket.checks[victim].store(key ^ data, memory_order_relaxed);
+}
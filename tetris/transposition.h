@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Fixed-size cache of search results keyed by position hash, shared by any number of
+// threads without locks. A slot holds its key XORed with its data, so a slot torn by
+// two racing writers fails the key check and reads as a miss rather than wrong data.
+class TranspositionTable final
+{
+public:
+    struct Entry
+    {
+        int32_t value;
+        uint16_t move;
+        uint8_t depth;
+    };
+
+    // Rounded down to a power of two buckets of 64 bytes; the only allocation it makes.
+    explicit TranspositionTable(size_t bytes);
+
+    bool probe(uint64_t key, Entry&) const;
+    // Replaces the same key, else the bucket's oldest and then shallowest entry.
+    void store(uint64_t key, const Entry&);
+    // Starts a new search: what is stored from now on outranks everything before it.
+    void age() { mGeneration.fetch_add(1, std::memory_order_relaxed); }
+    void clear();
+
+    size_t capacity() const { return (mMask + 1) * WAYS; }
+
+private:
+    static constexpr int WAYS = 4;
+    static constexpr uint64_t USED = 1ull << 63;
+    static constexpr int GENERATION_SHIFT = 56;
+    static constexpr uint64_t GENERATION_MASK = 0x7F;
+
+    struct alignas(64) Bucket
+    {
+        std::atomic<uint64_t> checks[WAYS];
+        std::atomic<uint64_t> data[WAYS];
+    };
+    static_assert(sizeof(Bucket) == 64, "one bucket per cache line");
+
+    static uint64_t pack(const Entry&, uint64_t generation);
+    static Entry unpack(uint64_t data);
+
+    std::unique_ptr<char[]> mStorage;
+    Bucket* mBuckets;
+    size_t mMask;
+    std::atomic<uint64_t> mGeneration { 0 };
+};